@@ -2,6 +2,7 @@
 
 /* appearance */
 #define BARPOS			BarTop /* BarBot, BarOff */
+#define BANMODE			BanMove /* BanUnmap - unmap hidden clients */
 #define BORDERPX		1
 #define FONT			"-*-terminus-medium-*-*-*-*-*-*-*-*-*-*-*"
 #define NORMBORDERCOLOR		"#cccccc"
@@ -11,6 +12,18 @@
 #define SELBGCOLOR		"#0066ff"
 #define SELFGCOLOR		"#ffffff"
 
+/* upper bound of bar redraws per second when built with -DBARTHREAD */
+#define BARFPS			60
+
+/* upper bound of arranges per second while an adjust key is held */
+#define ADJUSTFPS		10
+
+/* usec per event loop for property and expose events, input goes first */
+#define PROPBUDGET		2000
+
+/* runtime configuration file below $HOME ($DWMRC overrides), NULL for none */
+#define CONFIGFILE		".dwmrc"
+
 /* tagging */
 const char tags[][MAXTAGLEN] = {
     "1", "2", "3", "4", "5", "6", "7", "8", "9" };
@@ -26,6 +39,18 @@ Layout layouts[] = {
 	{ "[X]",		layoutFullscreen },
 };
 
+#ifdef STATUS
+/* built-in status modules (-DSTATUS), they replace the status on stdin */
+StatusMod statusmods[] = {
+	/* module		argument		interval (s) */
+	{ status_load,		NULL,			5 },
+	{ status_mem,		NULL,			5 },
+	{ status_net,		"eth0",			1 },
+	{ status_battery,	"BAT0",			30 },
+	{ status_clock,		"%a %d %b %H:%M",	1 },
+};
+#endif
+
 Key KeysPrimary[] = {
     /* modifier	          key	     function	           argument */
     { Mod1Mask|ShiftMask, XK_Return, fn_exec,              "exec xterm" },
@@ -59,12 +84,14 @@ Key KeysSecondary[] = {
     
     { Mod1Mask,			XK_space,	fn_nextLayout,  NULL },
     { Mod1Mask,			XK_b,		fn_toggleBar,   NULL },
+    { Mod1Mask,			XK_o,		fn_sendToMonitor, NULL },
     { Mod1Mask,			XK_j,		fn_focusNext,   NULL },
     { 0,			XK_Escape,	fn_primaryKeys, NULL },
     { Mod1Mask,			XK_h,		fn_adjustVSplit, "-5" },
     { Mod1Mask,			XK_l,		fn_adjustVSplit, "+5" },
     { Mod1Mask|ShiftMask,	XK_c,		fn_killWindow,  NULL },
     { Mod1Mask|ShiftMask,	XK_q,		fn_killSession, NULL },
+    { Mod1Mask|ShiftMask,	XK_r,		fn_restart,     NULL },
     { Mod1Mask,			XK_a,		fn_adjustMonitorWidth, "-5" },
     { Mod1Mask,			XK_f,		fn_adjustMonitorWidth, "+5" },
     { Mod1Mask,			XK_s,		fn_adjustMonitorHeight, "-5" },
@@ -10,18 +10,50 @@ MANPREFIX = ${PREFIX}/share/man
 X11INC = /usr/X11R6/include
 X11LIB = /usr/X11R6/lib
 
+# Xrandr, comment if you don't want monitor hotplug
+XRANDRLIBS = -lXrandr
+XRANDRFLAGS = -DXRANDR
+
+# Xft, comment if you want core X fonts only
+XFTINC = -I/usr/include/freetype2
+XFTLIBS = -lXft -lXrender
+XFTFLAGS = -DXFT
+
+# client side bar rasterization (needs Xft), uncomment to use it; drop
+# -DXSHM and -lXext if MIT-SHM isn't available, the bar is then sent with
+# plain XPutImage
+#IMAGEBARFLAGS = -DIMAGEBAR -DXSHM
+#IMAGEBARLIBS = -lXext -lfreetype
+
+# bar drawing thread with its own X connection, uncomment to use it
+#BARTHREADFLAGS = -DBARTHREAD
+#BARTHREADLIBS = -lpthread
+
+# property reads on a helper thread with its own X connection (Linux,
+# needs eventfd), uncomment to use it
+#PROPTHREADFLAGS = -DPROPTHREAD
+#PROPTHREADLIBS = -lpthread
+
+# built-in status modules instead of a status loop on stdin (Linux, needs
+# timerfd), uncomment to use them
+#STATUSFLAGS = -DSTATUS
+
+# XTEST, only needed by the tools (make tools)
+TOOLLIBS = -lXtst
+
 # includes and libs
-INCS = -I. -I/usr/include -I${X11INC}
-LIBS = -L/usr/lib -lc -L${X11LIB} -lX11 -lXinerama
+INCS = -I. -I/usr/include -I${X11INC} ${XFTINC}
+LIBS = -L/usr/lib -lc -L${X11LIB} -lX11 -lXinerama ${XRANDRLIBS} ${XFTLIBS} ${IMAGEBARLIBS} ${BARTHREADLIBS} ${PROPTHREADLIBS}
 
 # flags
-CFLAGS = -Os ${INCS} -DVERSION=\"${VERSION}\"
+CPPFLAGS = -D_DEFAULT_SOURCE -D_POSIX_C_SOURCE=200809L
+CFLAGS = -Os ${INCS} ${CPPFLAGS} -DVERSION=\"${VERSION}\" ${XRANDRFLAGS} ${XFTFLAGS} ${IMAGEBARFLAGS} ${BARTHREADFLAGS} ${PROPTHREADFLAGS} ${STATUSFLAGS}
 LDFLAGS = -s ${LIBS}
-CFLAGS = -g -std=c99 -pedantic -Wall -O2 ${INCS} -DVERSION=\"${VERSION}\"
+CFLAGS = -g -std=c99 -pedantic -Wall -O2 ${INCS} ${CPPFLAGS} -DVERSION=\"${VERSION}\" ${XRANDRFLAGS} ${XFTFLAGS} ${IMAGEBARFLAGS} ${BARTHREADFLAGS} ${PROPTHREADFLAGS} ${STATUSFLAGS}
 LDFLAGS = -g ${LIBS}
 
 # Solaris
-#CFLAGS = -fast ${INCS} -DVERSION=\"${VERSION}\"
+#CFLAGS = -fast ${INCS} ${CPPFLAGS} -DVERSION=\"${VERSION}\" ${XRANDRFLAGS} ${XFTFLAGS} ${IMAGEBARFLAGS} ${BARTHREADFLAGS} ${PROPTHREADFLAGS} ${STATUSFLAGS}
 #LDFLAGS = ${LIBS}
 #CFLAGS += -xtarget=ultra
 
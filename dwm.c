@@ -22,13 +22,28 @@
 #include <errno.h>
 #include <locale.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/select.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 #include <sys/types.h>
 #include <sys/wait.h>
+#if defined(BARTHREAD) || defined(PROPTHREAD)
+#include <pthread.h>
+#endif
+#ifdef PROPTHREAD
+#include <sys/eventfd.h>
+#endif
+#ifdef STATUS
+#include <sys/timerfd.h>
+#endif
 #include <regex.h>
 #include <X11/cursorfont.h>
 #include <X11/keysym.h>
@@ -39,6 +54,23 @@
 // #ifdef XINERAMA
 #include <X11/extensions/Xinerama.h>
 // #endif
+#ifdef XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
+#ifdef XFT
+#include <X11/Xft/Xft.h>
+#endif
+#ifdef IMAGEBAR
+#ifndef XFT
+#error "IMAGEBAR needs XFT for its glyphs"
+#endif
+#ifdef XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
+#endif
+#include "trace.h"
 
 /*
  * macros 
@@ -54,28 +86,113 @@
  * enums 
  */
 enum { BarTop, BarBot, BarOff };        /* bar position */
+enum { BanMove, BanUnmap };             /* how hidden clients are banned */
+enum { ADJUST_BAR = 1, ADJUST_LAYOUT = 2 };     /* pending in m_adjust */
 enum { CurNormal, CurResize, CurMove, CurLast };        /* cursor */
 enum { ColBorder, ColFG, ColBG, ColLast };      /* color */
-enum { NetSupported, NetWMName, NetLast };      /* EWMH atoms */
-enum { WMProtocols, WMDelete, WMName, WMState, WMLast };        /* default 
-                                                                 * atoms */
+
+/*
+ * Atom tables.  Every atom dwm uses is listed exactly once here; the enums
+ * below and the name table handed to XInternAtoms() in setup() are both
+ * generated from these lists, so adding an atom never costs an extra round
+ * trip at startup.
+ */
+#define WMATOMS(X) \
+    X(WMProtocols,      "WM_PROTOCOLS") \
+    X(WMDelete,         "WM_DELETE_WINDOW") \
+    X(WMName,           "WM_NAME") \
+    X(WMState,          "WM_STATE") \
+    X(WMUtf8String,     "UTF8_STRING")
+
+#define NETATOMS(X) \
+    X(NetSupported,     "_NET_SUPPORTED") \
+    X(NetWMName,        "_NET_WM_NAME") \
+    X(NetSupportingWM,  "_NET_SUPPORTING_WM_CHECK") \
+    X(NetClientList,    "_NET_CLIENT_LIST") \
+    X(NetActiveWindow,  "_NET_ACTIVE_WINDOW") \
+    X(NetNumDesktops,   "_NET_NUMBER_OF_DESKTOPS") \
+    X(NetCurrentDesktop, "_NET_CURRENT_DESKTOP") \
+    X(NetDesktopNames,  "_NET_DESKTOP_NAMES") \
+    X(NetWMDesktop,     "_NET_WM_DESKTOP") \
+    X(NetWMState,       "_NET_WM_STATE") \
+    X(NetWMStateHidden, "_NET_WM_STATE_HIDDEN")
+
+#define ATOM_ENUM(id, name)     id,
+#define ATOM_NAME(id, name)     name,
+
+enum { NETATOMS(ATOM_ENUM) NetLast };   /* EWMH atoms */
+enum { WMATOMS(ATOM_ENUM) WMLast };     /* default atoms */
 
 /*
  * typedefs 
  */
+#ifdef IMAGEBAR
+typedef struct {
+    unsigned int g_key;         /* glyph index + 1, 0 is an empty slot */
+    int         g_left, g_top;
+    int         g_width, g_rows;
+    int         g_advance;
+    unsigned char *g_alpha;     /* g_width * g_rows coverage values */
+} BarGlyph;
+#endif
+
+typedef struct {
+    int ascent;
+    int descent;
+    int height;
+    XFontSet set;
+    XFontStruct *xfont;
+#ifdef XFT
+    XftFont *xft;
+#endif
+#ifdef IMAGEBAR
+    BarGlyph *glyphs;
+    unsigned int nglyphs, glyphcap;
+#endif
+} DCFont;
+
+typedef struct ScreenRes ScreenRes;
+struct ScreenRes {
+    ScreenRes  *r_next;
+    int         r_screen;
+    unsigned int r_refs;
+    unsigned long r_norm[ColLast];
+    unsigned long r_sel[ColLast];
+#ifdef XFT
+    XftColor    r_xftnorm[ColLast];
+    XftColor    r_xftsel[ColLast];
+#endif
+    GC          r_gc;
+    DCFont      r_font;
+    unsigned int r_blw;
+    unsigned int *r_tagw;
+};                              /* shared by all monitors of an X screen */
+
 typedef struct {
     int x, y, w, h;
-    unsigned long norm[ColLast];
-    unsigned long sel[ColLast];
+    unsigned long *norm;
+    unsigned long *sel;
     Drawable drawable;
     GC gc;
-    struct {
-        int ascent;
-        int descent;
-        int height;
-        XFontSet set;
-        XFontStruct *xfont;
-    } font;
+#ifdef XFT
+    XftDraw *xftdraw;
+    XftColor *xftnorm;
+    XftColor *xftsel;
+#endif
+#ifdef IMAGEBAR
+    XImage *img;
+    Bool shm;
+#ifdef XSHM
+    XShmSegmentInfo shminfo;
+#endif
+#endif
+    DCFont *font;
+    unsigned int *tagw;
+    ScreenRes *res;
+    Bool valid;                 /* the tag cells below are in drawable */
+    int lastws;
+    unsigned int lastocc, lasturg;
+    Bool lasthassel;
 } DC;                           /* draw context */
 
 typedef struct {
@@ -85,18 +202,72 @@ typedef struct {
     const char *arg;
 } Key;
 
+typedef struct Monitor Monitor;
+
 typedef struct {
     const char *symbol;
-    void (*arrange) (void);
+    void (*arrange) (Monitor * m);
 } Layout;
 
+typedef struct {
+    Key        *keys;
+    unsigned int nkeys;
+    Bool        own;            /* keys were allocated by the parser */
+    KeyCode    *codes;          /* keycode of each key */
+    int        *next;           /* next key with the same keycode */
+    int         first[256];     /* keycode -> first key, -1 if none */
+} KeyMap;
+
+typedef struct {
+    KeyMap      cf_keys[2];     /* primary, secondary */
+    Layout     *cf_layouts;
+    unsigned int cf_nlayouts;
+    Bool        cf_ownlayouts;
+    const char *cf_colors[2][ColLast];  /* norm, sel */
+    int         cf_vsplit;
+    int         cf_snap;
+    unsigned int cf_borderpx;
+    char       *cf_buf;         /* file contents, strings point into it */
+} Config;
+
+#ifdef STATUS
+typedef struct StatusMod StatusMod;
+struct StatusMod {
+    void        (*sm_func) (StatusMod * s, char *buf, unsigned int size);
+    const char *sm_arg;
+    unsigned int sm_interval;   /* seconds */
+    unsigned long long sm_due;  /* tick of the next refresh */
+    unsigned long long sm_ran;  /* tick of the last refresh */
+    int         sm_fd[2];       /* kept open, -1 not yet, -2 unavailable */
+    unsigned long long sm_last[2];
+    char        sm_text[64];
+};
+#endif
+
+#define TITLE_MAXLEN	255
+
+typedef struct Title Title;
+struct Title {
+    Title      *t_next;         /* hash chain, or free list */
+    unsigned int t_hash;
+    unsigned int t_len;
+    unsigned int t_refs;
+    char        t_str[];
+};                              /* interned client title */
+
+typedef struct {
+    int         g_x, g_y, g_w, g_h;
+} Geom;
+
 typedef struct Client Client;
 struct Client {
-    Client     *c_next[10];
+    Client     *c_next[10];     /* workspace lists of c_monitor */
     Client     *c_prev[10];
+    Client     *c_gnext;        /* list of all clients */
+    Client     *c_gprev;
 
     Window      c_win;
-    char        c_name[256];
+    Title      *c_title;
     int         x, y, w, h;
     int         c_xunits, c_yunits;
 
@@ -113,6 +284,13 @@ struct Client {
     Bool        c_isfixed;
     Bool        c_isfloating;
     Bool        c_isurgent;
+    Bool        c_desktopdirty;
+    int         c_ignoreunmap;
+    Bool        c_migrated;
+    Bool        c_grabbed;      /* click to focus grab is in place */
+    Bool        c_stale;        /* c_pending still to be applied */
+    Geom        c_pending;
+    Geom        c_geom[10];     /* last layout request per workspace */
     
     /* Don't want these. */
     Client     *snext;
@@ -129,7 +307,13 @@ typedef struct Workspaces {
 Workspaces workspaces;
 Client *rootClient = &workspaces.w_client;
 
-typedef struct Monitor Monitor;
+typedef struct {
+    void        (*k_arrange) (Monitor * m);
+    unsigned int k_gen;
+    int         k_vsplit;
+    int         k_wax, k_way, k_waw, k_wah;
+} LayoutKey;                    /* inputs of a workspace's last layout */
+
 struct Monitor {
     int         m_screen;
     Window      m_root;
@@ -139,6 +323,14 @@ struct Monitor {
     int         wax, way, wah, waw;
     DC          dc;
     int         m_workspace;
+    Client     *m_clients;      /* sentinel of the workspace lists */
+    unsigned short m_wsclients[10];     /* clients of this monitor per workspace */
+    unsigned short m_wsurgent[10];      /* ... of which are urgent */
+    unsigned int m_occupied;    /* workspace bits, m_wsclients[w] > 0 */
+    unsigned int m_urgent;      /* workspace bits, m_wsurgent[w] > 0 */
+    unsigned int m_wsgen[10];   /* bumped when a layout input changes */
+    unsigned int m_adjust;      /* ADJUST_ work left for adjust_flush() */
+    LayoutKey   m_lkey[10];
 };
 
 /*
@@ -161,9 +353,18 @@ void fn_focusNext(const char *arg);
 void fn_exec(const char *arg);
 void fn_killWindow(const char *arg);
 void fn_killSession(const char *arg);
+void fn_restart(const char *arg);
+
+void layoutTile(Monitor * m);
+void layoutFullscreen(Monitor * m);
 
-void layoutTile(void);
-void layoutFullscreen(void);
+#ifdef STATUS
+void status_clock(StatusMod * s, char *buf, unsigned int size);
+void status_load(StatusMod * s, char *buf, unsigned int size);
+void status_mem(StatusMod * s, char *buf, unsigned int size);
+void status_net(StatusMod * s, char *buf, unsigned int size);
+void status_battery(StatusMod * s, char *buf, unsigned int size);
+#endif
 
 void fn_nextLayout(const char *arg);
 //void fn_prevLayout(const char *arg);
@@ -174,6 +375,7 @@ void fn_adjustMonitorWidth(const char *arg);
 void fn_adjustMonitorHeight(const char *arg);
 
 void fn_toggleBar(const char *arg);
+void fn_sendToMonitor(const char *arg);
 
 
 
@@ -183,11 +385,15 @@ void fn_toggleBar(const char *arg);
 
 
 void updatebarpos(Monitor * m);
+Bool updategeom(void);
 
 void movemouse(Client * c);
 void resizemouse(Client * c);
 
 void arrange(void);
+void monitor_arrange(Monitor * m);
+void layout_place(Client * c, int workspace, int x, int y, int w, int h,
+                  Bool lazy);
 
 //void attachstack(Client *c);
 //void detachstack(Client *c);
@@ -197,8 +403,15 @@ void focus(Client * c);
 Bool isvisible(Client * c, int monitor);
 
 void resize(Client * c, int x, int y, int w, int h, Bool sizehints);
+void sizehints_solve(const Client * c, int *pw, int *ph, int *xunits,
+                     int *yunits);
+void setclientstate(Client * c, long state);
+int xerror(Display * dpy, XErrorEvent * ee);
+Bool parsecolor(const char *colstr, XColor * color);
 void restack(void);
 int monitorat(void);
+void buttons_grab(void);
+Client *getclient(Window w);
 
 
 /*
@@ -210,17 +423,26 @@ int (*xerrorxlib) (Display *, XErrorEvent *);
 unsigned int bh, bpos;
 unsigned int blw = 0;
 unsigned int numlockmask = 0;
+unsigned int buttonlockmask = ~0;       /* numlockmask of the root button grabs */
 Atom wmatom[WMLast], netatom[NetLast];
 Bool isxinerama = False;
 Bool readin;
 Bool running = True;
+Bool restarting = False;
+int restorefd = -1;
 Client *sel = NULL;
 Client *stack = NULL;
 Cursor cursor[CurLast];
 Display *dpy;
+Display *bdpy;                  /* the bars are drawn on this connection */
 DC dc = { 0 };
 Monitor *monitors;
 int selmonitor = 0;
+Config defconfig;
+Config *cfg = &defconfig;
+#ifdef XRANDR
+int rrevbase = -1;
+#endif
 
 /*
  * configuration, allows nested code to access above variables 
@@ -264,6 +486,457 @@ emallocz(unsigned int size)
 }
 
 
+/*********************************
+ * Event Trace Functionality
+ *********************************/
+
+/*
+ * dwm -t file records every event handled by run(), movemouse() and
+ * resizemouse() together with the time and the number of X requests its
+ * handling took, in the format of trace.h. dwmreplay turns such a trace
+ * back into a benchmark. Without -t this costs a NULL check per event. 
+ */
+FILE *evtrace = NULL;
+struct timespec evtracestart;
+Atom evtraceatoms[64];
+unsigned int nevtraceatoms = 0;
+
+uint64_t
+evtrace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) (ts.tv_sec - evtracestart.tv_sec) * 1000000 +
+        (ts.tv_nsec - evtracestart.tv_nsec) / 1000;
+}
+
+void
+evtrace_open(const char *path)
+{
+    TraceHeader h = { TRACE_MAGIC, TRACE_VERSION, sizeof(TraceRecord), 0 };
+
+    if (!(evtrace = fopen(path, "wb")))
+        EXIT("dwm: cannot open trace file %s\n", path);
+    fcntl(fileno(evtrace), F_SETFD, FD_CLOEXEC);
+    fwrite(&h, sizeof h, 1, evtrace);
+    clock_gettime(CLOCK_MONOTONIC, &evtracestart);
+}
+
+/*
+ * Atoms are server specific, the replay needs their names. 
+ */
+void
+evtrace_atom(Atom a)
+{
+    unsigned int i;
+    char *name;
+    TraceRecord r;
+
+    if (a <= XA_LAST_PREDEFINED)
+        return;
+    for (i = 0; i < nevtraceatoms; i++)
+        if (evtraceatoms[i] == a)
+            return;
+    if (nevtraceatoms < LENGTH(evtraceatoms))
+        evtraceatoms[nevtraceatoms++] = a;
+    if (!(name = XGetAtomName(dpy, a)))
+        return;
+    memset(&r, 0, sizeof r);
+    r.t_type = TRACE_ATOMNAME;
+    r.t_extra = a;
+    r.t_w = strlen(name);
+    fwrite(&r, sizeof r, 1, evtrace);
+    fwrite(name, r.t_w, 1, evtrace);
+    XFree(name);
+}
+
+void
+evtrace_begin(TraceRecord * r, XEvent * ev, int origin)
+{
+    Client *c;
+
+    if (!evtrace)
+        return;
+    memset(r, 0, sizeof *r);
+    r->t_type = ev->type;
+    r->t_origin = origin;
+    r->t_window = r->t_subject = ev->xany.window;
+    switch (ev->type) {
+    case KeyPress:
+        r->t_extra = ev->xkey.keycode;
+        r->t_keysym = XLookupKeysym(&ev->xkey, 0);
+        r->t_state = ev->xkey.state;
+        break;
+    case ButtonPress:
+    case ButtonRelease:
+        r->t_extra = ev->xbutton.button;
+        r->t_state = ev->xbutton.state;
+        r->t_x = ev->xbutton.x_root;
+        r->t_y = ev->xbutton.y_root;
+        break;
+    case MotionNotify:
+        r->t_state = ev->xmotion.state;
+        r->t_x = ev->xmotion.x_root;
+        r->t_y = ev->xmotion.y_root;
+        break;
+    case EnterNotify:
+        r->t_extra = ev->xcrossing.detail;
+        r->t_state = ev->xcrossing.mode;
+        r->t_x = ev->xcrossing.x_root;
+        r->t_y = ev->xcrossing.y_root;
+        break;
+    case Expose:
+        r->t_extra = ev->xexpose.count;
+        r->t_x = ev->xexpose.x;
+        r->t_y = ev->xexpose.y;
+        r->t_w = ev->xexpose.width;
+        r->t_h = ev->xexpose.height;
+        break;
+    case MapRequest:
+        r->t_subject = ev->xmaprequest.window;
+        break;
+    case UnmapNotify:
+        r->t_subject = ev->xunmap.window;
+        /*
+         * dwm's own unmaps, unmapnotify() ignores them 
+         */
+        if (!ev->xunmap.send_event && (c = getclient(ev->xunmap.window)))
+            r->t_state = c->c_ignoreunmap > 0;
+        break;
+    case DestroyNotify:
+        r->t_subject = ev->xdestroywindow.window;
+        break;
+    case ConfigureRequest:
+        r->t_subject = ev->xconfigurerequest.window;
+        r->t_extra = ev->xconfigurerequest.value_mask;
+        r->t_state = ev->xconfigurerequest.border_width;
+        r->t_x = ev->xconfigurerequest.x;
+        r->t_y = ev->xconfigurerequest.y;
+        r->t_w = ev->xconfigurerequest.width;
+        r->t_h = ev->xconfigurerequest.height;
+        break;
+    case ConfigureNotify:
+        r->t_subject = ev->xconfigure.window;
+        r->t_x = ev->xconfigure.x;
+        r->t_y = ev->xconfigure.y;
+        r->t_w = ev->xconfigure.width;
+        r->t_h = ev->xconfigure.height;
+        break;
+    case PropertyNotify:
+        evtrace_atom(ev->xproperty.atom);
+        r->t_extra = ev->xproperty.atom;
+        r->t_state = ev->xproperty.state;
+        break;
+    case ClientMessage:
+        evtrace_atom(ev->xclient.message_type);
+        r->t_extra = ev->xclient.message_type;
+        break;
+    case MappingNotify:
+        r->t_extra = ev->xmapping.request;
+        break;
+    }
+    r->t_requests = NextRequest(dpy);
+    r->t_usec = evtrace_now();
+}
+
+void
+evtrace_end(TraceRecord * r)
+{
+    if (!evtrace)
+        return;
+    r->t_latency = evtrace_now() - r->t_usec;
+    r->t_requests = NextRequest(dpy) - r->t_requests;
+    fwrite(r, sizeof *r, 1, evtrace);
+}
+
+/*
+ * Called before blocking, so a killed dwm leaves a complete trace. 
+ */
+void
+evtrace_flush(void)
+{
+    if (evtrace)
+        fflush(evtrace);
+}
+
+
+/*********************************
+ * Runtime Configuration
+ *********************************/
+
+/*
+ * config.h provides the compiled in defaults. An optional configuration
+ * file ($DWMRC, or CONFIGFILE below $HOME) is parsed into a complete new
+ * Config, including the keycode dispatch tables, which replaces the current
+ * one as a whole, and only if the file parsed cleanly. run() watches the
+ * file with inotify; config_apply() then only regrabs the keys that
+ * changed and only repaints if colors or layout symbols changed.
+ *
+ *   set vsplit|snap|borderpx <n>
+ *   color norm|sel border|bg|fg <#rrggbb>
+ *   layout <symbol> tile|fullscreen
+ *   key primary|secondary <Mod1|Shift|...|0> <keysym> <action> [arg]
+ *
+ * Any layout or key line replaces the compiled in list of its kind.
+ */
+typedef struct {
+    const char *a_name;
+    void (*a_func) (const char *arg);
+    Bool        a_intarg;       /* argument is a number, not a string */
+} Action;
+
+Action actions[] = {
+    { "primaryKeys",            fn_primaryKeys,             False },
+    { "secondaryKeys",          fn_secondaryKeys,           False },
+    { "viewNextWorkspace",      fn_viewNextWorkspace,       False },
+    { "viewPrevWorkspace",      fn_viewPrevWorkspace,       False },
+    { "viewWorkspace",          fn_viewWorkspace,           True },
+    { "addToWorkspace",         fn_addToWorkspace,          True },
+    { "removeFromWorkspace",    fn_removeFromWorkspace,     True },
+    { "addToAllWorkspaces",     fn_addToAllWorkspaces,      False },
+    { "removeFromAllWorkspaces", fn_removeFromAllWorkspaces, False },
+    { "focusNext",              fn_focusNext,               False },
+    { "exec",                   fn_exec,                    False },
+    { "killWindow",             fn_killWindow,              False },
+    { "killSession",            fn_killSession,             False },
+    { "restart",                fn_restart,                 False },
+    { "nextLayout",             fn_nextLayout,              False },
+    { "adjustVSplit",           fn_adjustVSplit,            False },
+    { "adjustMonitorWidth",     fn_adjustMonitorWidth,      False },
+    { "adjustMonitorHeight",    fn_adjustMonitorHeight,     False },
+    { "toggleBar",              fn_toggleBar,               False },
+    { "sendToMonitor",          fn_sendToMonitor,           False },
+};
+
+Layout layoutfuncs[] = {
+    { "tile",           layoutTile },
+    { "fullscreen",     layoutFullscreen },
+};
+
+void
+config_default(void)
+{
+    defconfig.cf_keys[0].keys = KeysPrimary;
+    defconfig.cf_keys[0].nkeys = LENGTH(KeysPrimary);
+    defconfig.cf_keys[1].keys = KeysSecondary;
+    defconfig.cf_keys[1].nkeys = LENGTH(KeysSecondary);
+    defconfig.cf_layouts = layouts;
+    defconfig.cf_nlayouts = LENGTH(layouts);
+    defconfig.cf_colors[0][ColBorder] = NORMBORDERCOLOR;
+    defconfig.cf_colors[0][ColBG] = NORMBGCOLOR;
+    defconfig.cf_colors[0][ColFG] = NORMFGCOLOR;
+    defconfig.cf_colors[1][ColBorder] = SELBORDERCOLOR;
+    defconfig.cf_colors[1][ColBG] = SELBGCOLOR;
+    defconfig.cf_colors[1][ColFG] = SELFGCOLOR;
+    defconfig.cf_vsplit = VSPLIT;
+    defconfig.cf_snap = SNAP;
+    defconfig.cf_borderpx = BORDERPX;
+}
+
+void
+config_free(Config * c)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (c->cf_keys[i].own)
+            free(c->cf_keys[i].keys);
+        free(c->cf_keys[i].codes);
+        free(c->cf_keys[i].next);
+    }
+    if (c == &defconfig)
+        return;
+    if (c->cf_ownlayouts)
+        free(c->cf_layouts);
+    free(c->cf_buf);
+    free(c);
+}
+
+/*
+ * Builds the keycode dispatch table, keys_press() then only looks at the
+ * keys bound to the pressed keycode. 
+ */
+void
+keymap_index(KeyMap * km)
+{
+    int i;
+
+    free(km->codes);
+    free(km->next);
+    km->codes = emallocz((km->nkeys + 1) * sizeof(KeyCode));
+    km->next = emallocz((km->nkeys + 1) * sizeof(int));
+    for (i = 0; i < 256; i++)
+        km->first[i] = -1;
+    for (i = km->nkeys - 1; i >= 0; i--) {
+        km->codes[i] = XKeysymToKeycode(dpy, km->keys[i].keysym);
+        km->next[i] = km->first[km->codes[i]];
+        km->first[km->codes[i]] = i;
+    }
+}
+
+char *
+config_token(char **p)
+{
+    char *t;
+
+    while (**p == ' ' || **p == '\t')
+        (*p)++;
+    if (!**p)
+        return NULL;
+    t = *p;
+    while (**p && **p != ' ' && **p != '\t')
+        (*p)++;
+    if (**p)
+        *(*p)++ = '\0';
+    return t;
+}
+
+Bool
+config_parseMod(char *str, unsigned long *mod)
+{
+    char *t;
+    static const struct {
+        const char *name;
+        unsigned long mask;
+    } mods[] = {
+        { "Shift", ShiftMask }, { "Lock", LockMask },
+        { "Control", ControlMask }, { "Mod1", Mod1Mask },
+        { "Mod2", Mod2Mask }, { "Mod3", Mod3Mask },
+        { "Mod4", Mod4Mask }, { "Mod5", Mod5Mask }, { "0", 0 },
+    };
+    unsigned int i;
+
+    *mod = 0;
+    for (t = strtok(str, "|"); t; t = strtok(NULL, "|")) {
+        for (i = 0; i < LENGTH(mods) && strcmp(t, mods[i].name); i++);
+        if (i == LENGTH(mods))
+            return False;
+        *mod |= mods[i].mask;
+    }
+    return True;
+}
+
+Config *
+config_parse(const char *path)
+{
+    FILE *f;
+    long size;
+    int lineno = 0, i, nlines = 1;
+    char *line, *next, *cmd, *a, *b, *c, *d;
+    unsigned int j;
+    XColor color;
+    Config *cf;
+    Key *k;
+
+    if (!(f = fopen(path, "r")))
+        return NULL;
+    cf = emallocz(sizeof(Config));
+    *cf = defconfig;
+    cf->cf_keys[0].codes = cf->cf_keys[1].codes = NULL;
+    cf->cf_keys[0].next = cf->cf_keys[1].next = NULL;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    if (size < 0) {
+        fclose(f);
+        goto error;
+    }
+    cf->cf_buf = emallocz(size + 1);
+    if (fread(cf->cf_buf, 1, size, f) != (size_t) size) {
+        fclose(f);
+        goto error;
+    }
+    fclose(f);
+    for (i = 0; i < size; i++)
+        if (cf->cf_buf[i] == '\n')
+            nlines++;
+
+    for (line = cf->cf_buf; line; line = next) {
+        lineno++;
+        if ((next = strchr(line, '\n')))
+            *next++ = '\0';
+        if (!(cmd = config_token(&line)) || cmd[0] == '#')
+            continue;
+
+        if (!strcmp(cmd, "set")) {
+            if (!(a = config_token(&line)) || !(b = config_token(&line)))
+                goto syntax;
+            if (!strcmp(a, "vsplit"))
+                cf->cf_vsplit = atoi(b);
+            else if (!strcmp(a, "snap"))
+                cf->cf_snap = atoi(b);
+            else if (!strcmp(a, "borderpx"))
+                cf->cf_borderpx = atoi(b);
+            else
+                goto syntax;
+        } else if (!strcmp(cmd, "color")) {
+            if (!(a = config_token(&line)) || !(b = config_token(&line))
+                || !(c = config_token(&line)) || !parsecolor(c, &color))
+                goto syntax;
+            i = !strcmp(a, "sel") ? 1 : !strcmp(a, "norm") ? 0 : -1;
+            j = !strcmp(b, "border") ? ColBorder : !strcmp(b, "bg") ? ColBG
+                : !strcmp(b, "fg") ? ColFG : ColLast;
+            if (i < 0 || j == ColLast)
+                goto syntax;
+            cf->cf_colors[i][j] = c;
+        } else if (!strcmp(cmd, "layout")) {
+            if (!(a = config_token(&line)) || !(b = config_token(&line)))
+                goto syntax;
+            for (j = 0; j < LENGTH(layoutfuncs)
+                 && strcmp(b, layoutfuncs[j].symbol); j++);
+            if (j == LENGTH(layoutfuncs))
+                goto syntax;
+            if (!cf->cf_ownlayouts) {
+                cf->cf_layouts = emallocz(nlines * sizeof(Layout));
+                cf->cf_nlayouts = 0;
+                cf->cf_ownlayouts = True;
+            }
+            cf->cf_layouts[cf->cf_nlayouts].symbol = a;
+            cf->cf_layouts[cf->cf_nlayouts++].arrange = layoutfuncs[j].arrange;
+        } else if (!strcmp(cmd, "key")) {
+            if (!(a = config_token(&line)) || !(b = config_token(&line))
+                || !(c = config_token(&line)) || !(d = config_token(&line)))
+                goto syntax;
+            i = !strcmp(a, "secondary") ? 1 : !strcmp(a, "primary") ? 0 : -1;
+            if (i < 0)
+                goto syntax;
+            if (!cf->cf_keys[i].own) {
+                cf->cf_keys[i].keys = emallocz(nlines * sizeof(Key));
+                cf->cf_keys[i].nkeys = 0;
+                cf->cf_keys[i].own = True;
+            }
+            k = &cf->cf_keys[i].keys[cf->cf_keys[i].nkeys];
+            if (!config_parseMod(b, &k->mod)
+                || (k->keysym = XStringToKeysym(c)) == NoSymbol)
+                goto syntax;
+            for (j = 0; j < LENGTH(actions) && strcmp(d, actions[j].a_name);
+                 j++);
+            if (j == LENGTH(actions))
+                goto syntax;
+            k->func = actions[j].a_func;
+            while (*line == ' ' || *line == '\t')
+                line++;
+            if (actions[j].a_intarg)
+                k->arg = (const char *) (long) atoi(line);
+            else
+                k->arg = *line ? line : NULL;
+            cf->cf_keys[i].nkeys++;
+        } else
+            goto syntax;
+    }
+    if (cf->cf_nlayouts == 0)
+        goto error;
+    return cf;
+
+  syntax:
+    fprintf(stderr, "dwm: %s:%d: syntax error\n", path, lineno);
+  error:
+    config_free(cf);
+    return NULL;
+}
+
+
 /*********************************
  * Key Functionality
  *********************************/
@@ -274,10 +947,9 @@ emallocz(unsigned int size)
 int KeysMode = KEYS_MODE_PRIMARY;
 
 void
-keys_grabPrimary(void)
+keys_updateNumlock(void)
 {
     unsigned int i, j;
-    KeyCode code;
     XModifierKeymap *modmap;
 
     /*
@@ -291,43 +963,46 @@ keys_grabPrimary(void)
                 numlockmask = (1 << i);
         }
     XFreeModifiermap(modmap);
+}
+
+void
+keys_grabKey(KeyCode code, unsigned long mod, Bool grab)
+{
+    unsigned int i;
+    unsigned long mods[] = { 0, LockMask, numlockmask, numlockmask | LockMask };
+    unsigned int j;
 
     for (i = 0; i < mcount; i++) {
         Monitor *m = &monitors[i];
-        XUngrabKey(dpy, AnyKey, AnyModifier, m->m_root);
-        for (j = 0; j < LENGTH(KeysPrimary); j++) {
-            code = XKeysymToKeycode(dpy, KeysPrimary[j].keysym);
-            XGrabKey(dpy, code, KeysPrimary[j].mod, m->m_root, True,
-                     GrabModeAsync, GrabModeAsync);
-            XGrabKey(dpy, code, KeysPrimary[j].mod | LockMask, m->m_root,
-                     True, GrabModeAsync, GrabModeAsync);
-            XGrabKey(dpy, code, KeysPrimary[j].mod | numlockmask, m->m_root,
-                     True, GrabModeAsync, GrabModeAsync);
-            XGrabKey(dpy, code,
-                     KeysPrimary[j].mod | numlockmask | LockMask, m->m_root,
-                     True, GrabModeAsync, GrabModeAsync);
+        for (j = 0; j < LENGTH(mods); j++) {
+            if (grab)
+                XGrabKey(dpy, code, mod | mods[j], m->m_root, True,
+                         GrabModeAsync, GrabModeAsync);
+            else
+                XUngrabKey(dpy, code, mod | mods[j], m->m_root);
         }
     }
 }
 
 void
-keys_grabSecondary(void)
+keys_grabPrimary(void)
 {
     unsigned int i, j;
-    XModifierKeymap *modmap;
+    KeyMap *km = &cfg->cf_keys[0];
 
-    /*
-     * init modifier map 
-     */
-    modmap = XGetModifierMapping(dpy);
-    for (i = 0; i < 8; i++)
-        for (j = 0; j < modmap->max_keypermod; j++) {
-            if (modmap->modifiermap[i * modmap->max_keypermod + j] ==
-                XKeysymToKeycode(dpy, XK_Num_Lock))
-                numlockmask = (1 << i);
-        }
-    XFreeModifiermap(modmap);
+    keys_updateNumlock();
+    for (i = 0; i < mcount; i++)
+        XUngrabKey(dpy, AnyKey, AnyModifier, monitors[i].m_root);
+    for (j = 0; j < km->nkeys; j++)
+        keys_grabKey(km->codes[j], km->keys[j].mod, True);
+}
+
+void
+keys_grabSecondary(void)
+{
+    unsigned int i;
 
+    keys_updateNumlock();
     for (i = 0; i < mcount; i++) {
         Monitor *m = &monitors[i];
         XUngrabKey(dpy, AnyKey, AnyModifier, m->m_root);
@@ -344,50 +1019,50 @@ keys_grab(void)
     } else {
         keys_grabSecondary();
     }
+    buttons_grab();
 }
 
-void
-keys_pressPrimary(XEvent * e)
+Bool
+keys_hasKey(KeyMap * km, KeyCode code, unsigned long mod)
 {
-    unsigned int i;
-    KeySym keysym;
-    XKeyEvent *ev;
-
-    ev = &e->xkey;
-    keysym = XKeycodeToKeysym(dpy, (KeyCode) ev->keycode, 0);
-    for (i = 0; i < LENGTH(KeysPrimary); i++)
-        if (keysym == KeysPrimary[i].keysym
-            && CLEANMASK(KeysPrimary[i].mod) == CLEANMASK(ev->state)) {
-            if (KeysPrimary[i].func)
-                KeysPrimary[i].func(KeysPrimary[i].arg);
-        }
+    int i;
+
+    for (i = km->first[code]; i != -1; i = km->next[i])
+        if (km->keys[i].mod == mod)
+            return True;
+    return False;
 }
 
+/*
+ * Only touches the grabs of keys which were added or removed. 
+ */
 void
-keys_pressSecondary(XEvent * e)
+keys_regrab(KeyMap * old, KeyMap * new)
 {
     unsigned int i;
-    KeySym keysym;
-    XKeyEvent *ev;
-
-    ev = &e->xkey;
-    keysym = XKeycodeToKeysym(dpy, (KeyCode) ev->keycode, 0);
-    for (i = 0; i < LENGTH(KeysSecondary); i++)
-        if (keysym == KeysSecondary[i].keysym
-            && CLEANMASK(KeysSecondary[i].mod) == CLEANMASK(ev->state)) {
-            if (KeysSecondary[i].func)
-                KeysSecondary[i].func(KeysSecondary[i].arg);
-        }
+
+    if (KeysMode != KEYS_MODE_PRIMARY)
+        return;
+    for (i = 0; i < old->nkeys; i++)
+        if (!keys_hasKey(new, old->codes[i], old->keys[i].mod))
+            keys_grabKey(old->codes[i], old->keys[i].mod, False);
+    for (i = 0; i < new->nkeys; i++)
+        if (!keys_hasKey(old, new->codes[i], new->keys[i].mod))
+            keys_grabKey(new->codes[i], new->keys[i].mod, True);
 }
 
 void
 keys_press(XEvent * e)
 {
-    if (KeysMode == KEYS_MODE_PRIMARY) {
-        keys_pressPrimary(e);
-    } else {
-        keys_pressSecondary(e);
-    }
+    int i;
+    XKeyEvent *ev = &e->xkey;
+    KeyMap *km = &cfg->cf_keys[KeysMode == KEYS_MODE_PRIMARY ? 0 : 1];
+
+    for (i = km->first[ev->keycode & 0xff]; i != -1; i = km->next[i])
+        if (CLEANMASK(km->keys[i].mod) == CLEANMASK(ev->state)) {
+            if (km->keys[i].func)
+                km->keys[i].func(km->keys[i].arg);
+        }
 }
 
 void
@@ -406,95 +1081,436 @@ fn_secondaryKeys(const char *arg)
 
 
 /*********************************
- * Workspace Functionality
+ * EWMH Functionality
  *********************************/
 
-void
-fn_viewNextWorkspace(const char *arg)
+/*
+ * EWMH root properties are not written from the event handlers directly.
+ * Handlers only mark what changed in EwmhDirty and ewmh_flush() publishes
+ * it once per drained event batch from run(). Newly managed clients are
+ * appended to _NET_CLIENT_LIST in place; only removals force a rewrite.
+ */
+#define EWMH_DIRTY_CLIENTLIST   (1 << 0)
+#define EWMH_DIRTY_ACTIVE       (1 << 1)
+#define EWMH_DIRTY_DESKTOP      (1 << 2)
+#define EWMH_DIRTY_WMDESKTOP    (1 << 3)
+
+#define EWMH_ALLDESKTOPS        0xFFFFFFFF
+
+int EwmhDirty = 0;
+Window EwmhCheckWin = None;
+Window EwmhActive = None;
+long EwmhDesktop = -1;
+
+Bool
+ewmh_isFirstRoot(int monitor)
 {
-    Monitor *m = &monitors[monitorat()];
-    m->m_workspace = (m->m_workspace + 1) % 10;
-    arrange();
+    int i;
+
+    for (i = 0; i < monitor; i++)
+        if (monitors[i].m_root == monitors[monitor].m_root)
+            return False;
+    return True;
 }
 
 void
-fn_viewPrevWorkspace(const char *arg)
+ewmh_setRootProp(Atom atom, Atom type, int mode, void *data, int n)
 {
-    Monitor *m = &monitors[monitorat()];
-    m->m_workspace = (m->m_workspace + 9) % 10;
-    arrange();
+    int i;
+
+    for (i = 0; i < mcount; i++) {
+        if (!ewmh_isFirstRoot(i))
+            continue;
+        XChangeProperty(dpy, monitors[i].m_root, atom, type, 32, mode,
+                        (unsigned char *) data, n);
+    }
 }
 
 void
-fn_viewWorkspace(const char *arg)
+ewmh_addClient(Client * c)
 {
-    Monitor *m = &monitors[monitorat()];
-    m->m_workspace = (int) arg;
-    arrange();
+    /*
+     * a pending rewrite will pick the client up anyway 
+     */
+    if (!(EwmhDirty & EWMH_DIRTY_CLIENTLIST))
+        ewmh_setRootProp(netatom[NetClientList], XA_WINDOW, PropModeAppend,
+                         &c->c_win, 1);
+    c->c_desktopdirty = True;
+    EwmhDirty |= EWMH_DIRTY_WMDESKTOP;
 }
 
 void
-ws_attach(Client * c, int workspace)
+ewmh_setHidden(Client * c, Bool hidden)
 {
-    if (c->c_next[workspace] != NULL) {
-        // OOPS
-        return;
-    }
-
-    TRACE("Adding client to %d\n", workspace);
-    c->c_next[workspace] = rootClient;
-    c->c_prev[workspace] = rootClient->c_prev[workspace];
-    rootClient->c_prev[workspace]->c_next[workspace] = c;
-    rootClient->c_prev[workspace] = c;
-    workspaces.w_numClients[workspace]++;
+    XChangeProperty(dpy, c->c_win, netatom[NetWMState], XA_ATOM, 32,
+                    PropModeReplace,
+                    (unsigned char *) &netatom[NetWMStateHidden],
+                    hidden ? 1 : 0);
 }
 
 void
-ws_detach(Client * c, int workspace)
+ewmh_removeClient(Client * c)
 {
-    if (c->c_next[workspace] == NULL) {
-        // OOPS
-        return;
-    }
+    XDeleteProperty(dpy, c->c_win, netatom[NetWMDesktop]);
+    XDeleteProperty(dpy, c->c_win, netatom[NetWMState]);
+    if (EwmhActive == c->c_win)
+        EwmhActive = None;
+    EwmhDirty |= EWMH_DIRTY_CLIENTLIST | EWMH_DIRTY_ACTIVE;
+}
 
-    c->c_next[workspace]->c_prev[workspace] = c->c_prev[workspace];
-    c->c_prev[workspace]->c_next[workspace] = c->c_next[workspace];
-    c->c_next[workspace] = c->c_prev[workspace] = NULL;
-    workspaces.w_numClients[workspace]--;
+void
+ewmh_markClient(Client * c)
+{
+    c->c_desktopdirty = True;
+    EwmhDirty |= EWMH_DIRTY_WMDESKTOP;
 }
 
 void
-ws_detachAll(Client * c)
+ewmh_markDirty(int what)
 {
-    int w;
+    EwmhDirty |= what;
+}
 
-    for (w = 0; w < 10; w++) {
-        ws_detach(c, w);
+long
+ewmh_clientDesktop(Client * c)
+{
+    int w, first = 0, count = 0;
+
+    for (w = 9; w >= 1; w--) {
+        if (c->c_next[w] != NULL) {
+            first = w;
+            count++;
+        }
     }
+    return (count == 9) ? EWMH_ALLDESKTOPS : first;
 }
 
-
 void
-fn_addToWorkspace(const char *arg)
+ewmh_flush(void)
 {
-    int w = (int) arg;
-    if (w < 1 || w > 9) {
-        // OOPS
-        return;
-    }
+    int n;
+    long data;
+    Window *wins, active;
+    Client *c;
 
-    if (!sel)
+    if (!EwmhDirty)
         return;
 
-    ws_attach(sel, w);
+    if (EwmhDirty & EWMH_DIRTY_CLIENTLIST) {
+        n = workspaces.w_numClients[0];
+        wins = emallocz((n ? n : 1) * sizeof(Window));
+        n = 0;
+        c = rootClient->c_gnext;
+        for (; c != rootClient; c = c->c_gnext)
+            wins[n++] = c->c_win;
+        ewmh_setRootProp(netatom[NetClientList], XA_WINDOW, PropModeReplace,
+                         wins, n);
+        free(wins);
+    }
+    if (EwmhDirty & EWMH_DIRTY_WMDESKTOP) {
+        c = rootClient->c_gnext;
+        for (; c != rootClient; c = c->c_gnext) {
+            if (!c->c_desktopdirty)
+                continue;
+            data = ewmh_clientDesktop(c);
+            XChangeProperty(dpy, c->c_win, netatom[NetWMDesktop], XA_CARDINAL,
+                            32, PropModeReplace, (unsigned char *) &data, 1);
+            c->c_desktopdirty = False;
+        }
+    }
+    if (EwmhDirty & EWMH_DIRTY_ACTIVE) {
+        active = sel ? sel->c_win : None;
+        if (active != EwmhActive) {
+            EwmhActive = active;
+            ewmh_setRootProp(netatom[NetActiveWindow], XA_WINDOW,
+                             PropModeReplace, &active, 1);
+        }
+    }
+    if (EwmhDirty & EWMH_DIRTY_DESKTOP) {
+        data = monitors[selmonitor].m_workspace;
+        if (data != EwmhDesktop) {
+            EwmhDesktop = data;
+            ewmh_setRootProp(netatom[NetCurrentDesktop], XA_CARDINAL,
+                             PropModeReplace, &data, 1);
+        }
+    }
+    EwmhDirty = 0;
 }
 
 void
-fn_removeFromWorkspace(const char *arg)
+ewmh_setup(void)
 {
-    int w = (int) arg;
-    TRACE("%s %d %x\n", __func__, w, sel);
-    if (w < 1 || w > 9) {
+    int w;
+    long data;
+    char names[10 * MAXTAGLEN];
+    unsigned int len = 0;
+    Window root = monitors[0].m_root;
+
+    /*
+     * workspace 0 holds every client, 1-9 are named by tags 
+     */
+    for (w = 0; w < 10; w++) {
+        const char *name = (w == 0) ? "*" :
+            (w - 1 < LENGTH(tags)) ? tags[w - 1] : "";
+        strcpy(names + len, name);
+        len += strlen(name) + 1;
+    }
+
+    EwmhCheckWin = XCreateSimpleWindow(dpy, root, 0, 0, 1, 1, 0, 0, 0);
+    XChangeProperty(dpy, EwmhCheckWin, netatom[NetSupportingWM], XA_WINDOW,
+                    32, PropModeReplace, (unsigned char *) &EwmhCheckWin, 1);
+    XChangeProperty(dpy, EwmhCheckWin, netatom[NetWMName],
+                    wmatom[WMUtf8String], 8,
+                    PropModeReplace, (unsigned char *) "dwm", 3);
+    ewmh_setRootProp(netatom[NetSupportingWM], XA_WINDOW, PropModeReplace,
+                     &EwmhCheckWin, 1);
+    ewmh_setRootProp(netatom[NetSupported], XA_ATOM, PropModeReplace,
+                     netatom, NetLast);
+    data = 10;
+    ewmh_setRootProp(netatom[NetNumDesktops], XA_CARDINAL, PropModeReplace,
+                     &data, 1);
+    for (w = 0; w < mcount; w++) {
+        if (!ewmh_isFirstRoot(w))
+            continue;
+        XChangeProperty(dpy, monitors[w].m_root, netatom[NetDesktopNames],
+                        wmatom[WMUtf8String], 8,
+                        PropModeReplace, (unsigned char *) names, len);
+    }
+    ewmh_setRootProp(netatom[NetClientList], XA_WINDOW, PropModeReplace,
+                     NULL, 0);
+    EwmhDirty = EWMH_DIRTY_ACTIVE | EWMH_DIRTY_DESKTOP;
+}
+
+void
+ewmh_cleanup(void)
+{
+    int i;
+
+    for (i = 0; i < mcount; i++) {
+        if (!ewmh_isFirstRoot(i))
+            continue;
+        XDeleteProperty(dpy, monitors[i].m_root, netatom[NetClientList]);
+        XDeleteProperty(dpy, monitors[i].m_root, netatom[NetActiveWindow]);
+    }
+    XDestroyWindow(dpy, EwmhCheckWin);
+}
+
+
+/*********************************
+ * Workspace Functionality
+ *********************************/
+
+void
+fn_viewNextWorkspace(const char *arg)
+{
+    Monitor *m = &monitors[monitorat()];
+    m->m_workspace = (m->m_workspace + 1) % 10;
+    ewmh_markDirty(EWMH_DIRTY_DESKTOP);
+    monitor_arrange(m);
+}
+
+void
+fn_viewPrevWorkspace(const char *arg)
+{
+    Monitor *m = &monitors[monitorat()];
+    m->m_workspace = (m->m_workspace + 9) % 10;
+    ewmh_markDirty(EWMH_DIRTY_DESKTOP);
+    monitor_arrange(m);
+}
+
+void
+fn_viewWorkspace(const char *arg)
+{
+    Monitor *m = &monitors[monitorat()];
+    m->m_workspace = (int) arg;
+    ewmh_markDirty(EWMH_DIRTY_DESKTOP);
+    monitor_arrange(m);
+}
+
+/*
+ * Keeps the occupied and urgent workspace bits of c's monitor up to date,
+ * delta is +1 when c joins workspace, -1 when it leaves. 
+ */
+void
+ws_account(Client * c, int workspace, int delta)
+{
+    Monitor *m = &monitors[c->c_monitor];
+    unsigned int bit = 1 << workspace;
+
+    if ((m->m_wsclients[workspace] += delta))
+        m->m_occupied |= bit;
+    else
+        m->m_occupied &= ~bit;
+    if (!c->c_isurgent)
+        return;
+    if ((m->m_wsurgent[workspace] += delta))
+        m->m_urgent |= bit;
+    else
+        m->m_urgent &= ~bit;
+}
+
+void
+ws_accountAll(Client * c, int delta)
+{
+    int w;
+
+    for (w = 0; w < 10; w++)
+        if (c->c_next[w])
+            ws_account(c, w, delta);
+}
+
+void
+client_setUrgent(Client * c, Bool urgent)
+{
+    if (c->c_isurgent == urgent)
+        return;
+    ws_accountAll(c, -1);
+    c->c_isurgent = urgent;
+    ws_accountAll(c, 1);
+}
+
+/*
+ * Every client is owned by one monitor and linked into the workspace
+ * lists of that monitor only, so a layout walks its own head's clients. 
+ */
+void
+ws_link(Client * c, int workspace)
+{
+    Client *head = monitors[c->c_monitor].m_clients;
+
+    c->c_next[workspace] = head;
+    c->c_prev[workspace] = head->c_prev[workspace];
+    head->c_prev[workspace]->c_next[workspace] = c;
+    head->c_prev[workspace] = c;
+    workspaces.w_numClients[workspace]++;
+    monitors[c->c_monitor].m_wsgen[workspace]++;
+    ws_account(c, workspace, 1);
+}
+
+void
+ws_unlink(Client * c, int workspace)
+{
+    c->c_next[workspace]->c_prev[workspace] = c->c_prev[workspace];
+    c->c_prev[workspace]->c_next[workspace] = c->c_next[workspace];
+    c->c_next[workspace] = c->c_prev[workspace] = NULL;
+    workspaces.w_numClients[workspace]--;
+    monitors[c->c_monitor].m_wsgen[workspace]++;
+    ws_account(c, workspace, -1);
+}
+
+/*
+ * Something the layout of c's workspaces depends on changed, their
+ * cached geometry is void. 
+ */
+void
+ws_touch(Client * c)
+{
+    Monitor *m = &monitors[c->c_monitor];
+    int w;
+
+    for (w = 0; w < 10; w++)
+        if (c->c_next[w])
+            m->m_wsgen[w]++;
+}
+
+/*
+ * Hands c over to another monitor, it keeps its workspaces and goes to
+ * the end of their lists there. 
+ */
+void
+client_setMonitor(Client * c, int monitor)
+{
+    unsigned int on = 0;
+    int w;
+
+    if (c->c_monitor == monitor)
+        return;
+    for (w = 0; w < 10; w++) {
+        if (c->c_next[w] == NULL)
+            continue;
+        on |= 1 << w;
+        ws_unlink(c, w);
+    }
+    c->c_monitor = monitor;
+    for (w = 0; w < 10; w++)
+        if (on & (1 << w))
+            ws_link(c, w);
+}
+
+void
+client_attach(Client * c)
+{
+    c->c_gnext = rootClient;
+    c->c_gprev = rootClient->c_gprev;
+    rootClient->c_gprev->c_gnext = c;
+    rootClient->c_gprev = c;
+}
+
+void
+client_detach(Client * c)
+{
+    c->c_gnext->c_gprev = c->c_gprev;
+    c->c_gprev->c_gnext = c->c_gnext;
+    c->c_gnext = c->c_gprev = NULL;
+}
+
+void
+ws_attach(Client * c, int workspace)
+{
+    if (c->c_next[workspace] != NULL) {
+        // OOPS
+        return;
+    }
+
+    TRACE("Adding client to %d\n", workspace);
+    ws_link(c, workspace);
+    ewmh_markClient(c);
+}
+
+void
+ws_detach(Client * c, int workspace)
+{
+    if (c->c_next[workspace] == NULL) {
+        // OOPS
+        return;
+    }
+
+    ws_unlink(c, workspace);
+    ewmh_markClient(c);
+}
+
+void
+ws_detachAll(Client * c)
+{
+    int w;
+
+    for (w = 0; w < 10; w++) {
+        ws_detach(c, w);
+    }
+}
+
+
+void
+fn_addToWorkspace(const char *arg)
+{
+    int w = (int) arg;
+    if (w < 1 || w > 9) {
+        // OOPS
+        return;
+    }
+
+    if (!sel)
+        return;
+
+    ws_attach(sel, w);
+}
+
+void
+fn_removeFromWorkspace(const char *arg)
+{
+    int w = (int) arg;
+    TRACE("%s %d %x\n", __func__, w, sel);
+    if (w < 1 || w > 9) {
         // OOPS
         return;
     }
@@ -531,13 +1547,24 @@ fn_removeFromAllWorkspaces(const char *arg /* not used */ )
 
 /*
  * Arrange Windows.
+ *
+ * With BANMODE BanUnmap hidden clients are unmapped instead of being moved
+ * offscreen, so they stop rendering. Every unmap dwm issues itself is
+ * counted in c_ignoreunmap, so unmapnotify() doesn't take it for the client
+ * withdrawing.
  */
 void
 ban(Client * c)
 {
     if (c->c_isbanned)
         return;
-    XMoveWindow(dpy, c->c_win, c->x + 3 * monitors[c->c_monitor].m_width, c->y);
+    if (BANMODE == BanUnmap) {
+        c->c_ignoreunmap++;
+        XUnmapWindow(dpy, c->c_win);
+        setclientstate(c, IconicState);
+        ewmh_setHidden(c, True);
+    } else
+        XMoveWindow(dpy, c->c_win, c->x + 3 * monitors[c->c_monitor].m_width, c->y);
     c->c_isbanned = True;
 }
 
@@ -546,127 +1573,293 @@ unban(Client * c)
 {
     if (!c->c_isbanned)
         return;
-    XMoveWindow(dpy, c->c_win, c->x, c->y);
+    if (BANMODE == BanUnmap) {
+        XMapWindow(dpy, c->c_win);
+        setclientstate(c, NormalState);
+        ewmh_setHidden(c, False);
+    } else
+        XMoveWindow(dpy, c->c_win, c->x, c->y);
     c->c_isbanned = False;
 }
 
+/*
+ * Lays out m alone, clients of other heads are not touched. 
+ */
 void
-arrange(void)
+monitor_layout(Monitor * m)
 {
-    Client *c = rootClient->c_next[0];
-    for (; c != rootClient; c = c->c_next[0]) {
-        if (isvisible(c, selmonitor))
-            unban(c);
-        else
+    Client *head = m->m_clients, *c;
+    int workspace = m->m_workspace;
+    Layout *l = workspaces.w_layout[workspace];
+    LayoutKey key;
+    Geom *g;
+
+    memset(&key, 0, sizeof key);
+    key.k_arrange = l->arrange;
+    key.k_gen = m->m_wsgen[workspace];
+    key.k_vsplit = workspaces.w_vSplit[workspace];
+
+    /*
+     * hide first and show after the layout ran, so newly visible clients
+     * are mapped at their final geometry 
+     */
+    for (c = head->c_next[0]; c != head; c = c->c_next[0]) {
+        if (c->c_next[workspace] == NULL)
             ban(c);
     }
 
-    workspaces.w_layout[monitors[selmonitor].m_workspace]->arrange();
+    if (m->m_adjust & ADJUST_BAR) {
+        updatebarpos(m);
+        m->m_adjust &= ~ADJUST_BAR;
+    }
+    key.k_wax = m->wax;
+    key.k_way = m->way;
+    key.k_waw = m->waw;
+    key.k_wah = m->wah;
+
+    if (memcmp(&key, &m->m_lkey[workspace], sizeof key)) {
+        l->arrange(m);
+        m->m_lkey[workspace] = key;
+    } else {
+        /*
+         * nothing the layout depends on changed since it last ran here,
+         * put the tiled clients back where it wanted them. Clients still
+         * waiting for lazy geometry keep waiting. 
+         */
+        c = head->c_next[workspace];
+        for (; c != head; c = c->c_next[workspace]) {
+            g = &c->c_geom[workspace];
+            if (c->c_isfloating || (c->c_stale
+                && !memcmp(&c->c_pending, g, sizeof *g)))
+                continue;
+            layout_place(c, workspace, g->g_x, g->g_y, g->g_w, g->g_h,
+                         False);
+        }
+    }
+
+    for (c = head->c_next[workspace]; c != head; c = c->c_next[workspace])
+        unban(c);
+}
+
+void
+monitor_arrange(Monitor * m)
+{
+    monitor_layout(m);
     focus(NULL);
     restack();
 }
 
 /*
- * Layout algorithms
+ * Lays out every head showing workspace, after its layout or split
+ * changed. 
  */
+void
+ws_arrange(int workspace)
+{
+    int i;
+
+    for (i = 0; i < mcount; i++)
+        if (monitors[i].m_workspace == workspace)
+            monitor_layout(&monitors[i]);
+    focus(NULL);
+    restack();
+}
 
 void
-layoutFullscreen(void)
+arrange(void)
 {
-    unsigned int i, nx, ny, nw, nh;
-    Client *c;
+    int i;
 
-    for (i = 0; i < mcount; i++) {
-        Monitor *m = &monitors[i];
-        int workspace = m->m_workspace;
+    for (i = 0; i < mcount; i++)
+        monitor_layout(&monitors[i]);
+    focus(NULL);
+    restack();
+}
+
+/*
+ * Puts c on monitor and into the workspace shown there, so it stays
+ * visible where it was dropped. Only the two heads involved are laid out
+ * again. 
+ */
+void
+client_toMonitor(Client * c, int monitor)
+{
+    Monitor *m = &monitors[monitor];
+    int old = c->c_monitor;
+
+    if (old == monitor)
+        return;
+    client_setMonitor(c, monitor);
+    if (c->c_next[m->m_workspace] == NULL)
+        ws_attach(c, m->m_workspace);
+    monitor_layout(&monitors[old]);
+    monitor_layout(m);
+    focus(c);
+    restack();
+}
+
+/*
+ * Sends the selected client to the next monitor, floating clients keep
+ * their offset from the monitor origin. 
+ */
+void
+fn_sendToMonitor(const char *arg)
+{
+    Monitor *from, *to;
+    int i;
+
+    if (!sel || mcount < 2)
+        return;
+    i = (sel->c_monitor + 1) % mcount;
+    from = &monitors[sel->c_monitor];
+    to = &monitors[i];
+    if (sel->c_isfloating)
+        resize(sel, sel->x - from->m_xorig + to->m_xorig,
+               sel->y - from->m_yorig + to->m_yorig, sel->w, sel->h, True);
+    client_toMonitor(sel, i);
+}
 
+/*
+ * Layout algorithms
+ */
+
+/*
+ * Fits c into a layout cell. The hinted size is solved first and only
+ * dropped for the plain cell if it doesn't fit, so the client gets one
+ * configure at most. 
+ */
+void
+resizetiled(Client * c, int nx, int ny, int nw, int nh)
+{
+    int w = nw, h = nh;
+
+    if (RESIZEHINTS) {
+        sizehints_solve(c, &w, &h, &c->c_xunits, &c->c_yunits);
         /*
-         * window geoms 
+         * client doesn't accept size constraints 
          */
-        c = rootClient->c_next[workspace];
-        for (; c != rootClient; c = c->c_next[workspace]) {
-            if (c->c_isfloating)
-                continue;
+        if (h < bh || h > nh || w < bh || w > nw) {
+            w = nw;
+            h = nh;
+        }
+    }
+    resize(c, nx, ny, w, h, False);
+}
 
-            nx = m->wax;
-            ny = m->way;
-            nw = m->waw - 2 * c->c_border;
-            nh = m->wah - 2 * c->c_border;
+/*
+ * Applies the geometry a layout left pending on c, called once c gets
+ * raised or focused. 
+ */
+void
+client_flush(Client * c)
+{
+    if (!c->c_stale)
+        return;
+    c->c_stale = False;
+    resizetiled(c, c->c_pending.g_x, c->c_pending.g_y, c->c_pending.g_w,
+                c->c_pending.g_h);
+}
 
-            resize(c, nx, ny, nw, nh, RESIZEHINTS);
-            if ((RESIZEHINTS)
-                && ((c->h < bh) || (c->h > nh) || (c->w < bh)
-                    || (c->w > nw)))
-                /*
-                 * client doesn't accept size constraints 
-                 */
-                resize(c, nx, ny, nw, nh, False);
-        }
+/*
+ * Layouts hand their result to layout_place(), it is remembered for the
+ * workspace so monitor_layout() can reuse it. Lazy geometry is left for
+ * client_flush(). 
+ */
+void
+layout_place(Client * c, int workspace, int x, int y, int w, int h,
+             Bool lazy)
+{
+    Geom g = { x, y, w, h };
+
+    c->c_geom[workspace] = g;
+    c->c_pending = g;
+    c->c_stale = True;
+    if (!lazy)
+        client_flush(c);
+}
+
+/*
+ * Only the top client is visible, so only it gets configured. The others
+ * are left stale and configured by client_flush() when restack() raises
+ * them or they get the focus. The top one is sel if it is tiled here,
+ * else the first tiled client, the same one restack() puts on top. 
+ */
+void
+layoutFullscreen(Monitor * m)
+{
+    Client *head = m->m_clients, *c, *top = NULL;
+    int workspace = m->m_workspace;
+
+    if (sel && !sel->c_isfloating && isvisible(sel, m - monitors))
+        top = sel;
+
+    /*
+     * window geoms 
+     */
+    c = head->c_next[workspace];
+    for (; c != head; c = c->c_next[workspace]) {
+        if (c->c_isfloating)
+            continue;
+        if (!top)
+            top = c;
+
+        layout_place(c, workspace, m->wax, m->way,
+                     m->waw - 2 * c->c_border, m->wah - 2 * c->c_border,
+                     c != top);
     }
 }
 
 void
-layoutTile(void)
+layoutTile(Monitor * m)
 {
-    unsigned int i, j, n, nx, ny, nw, nh, mw, th;
-    Client *c, *mc;
+    unsigned int j, n, nx, ny, nw, nh, mw, th;
+    Client *head = m->m_clients, *c, *mc;
+    int workspace = m->m_workspace;
 
     nx = ny = nw = 0;           /* gcc stupidity requires this */
 
-    for (i = 0; i < mcount; i++) {
-        Monitor *m = &monitors[i];
-        int workspace = m->m_workspace;
-
-        c = rootClient->c_next[workspace];
-        for (n = 0; c != rootClient; c = c->c_next[workspace]) {
-            if (c->c_isfloating)
-                continue;
-            n++;
-        }
+    c = head->c_next[workspace];
+    for (n = 0; c != head; c = c->c_next[workspace]) {
+        if (c->c_isfloating)
+            continue;
+        n++;
+    }
 
-        /*
-         * window geoms 
-         */
-        mw = (n == 1) ? m->waw : workspaces.w_vSplit[workspace];
-        th = (n > 1) ? m->wah / (n - 1) : 0;
-        if (n > 1 && th < bh)
-            th = m->wah;
-
-        j = 0;
-        c = mc = rootClient->c_next[workspace];
-        for (; c != rootClient; c = c->c_next[workspace]) {
-            if (c->c_isfloating)
-                continue;
-            if (j == 0) {       /* master */
-                nx = m->wax;
+    /*
+     * window geoms 
+     */
+    mw = (n == 1) ? m->waw : workspaces.w_vSplit[workspace];
+    th = (n > 1) ? m->wah / (n - 1) : 0;
+    if (n > 1 && th < bh)
+        th = m->wah;
+
+    j = 0;
+    c = mc = head->c_next[workspace];
+    for (; c != head; c = c->c_next[workspace]) {
+        if (c->c_isfloating)
+            continue;
+        if (j == 0) {           /* master */
+            nx = m->wax;
+            ny = m->way;
+            nw = mw - 2 * c->c_border;
+            nh = m->wah - 2 * c->c_border;
+        } else {                /* tile window */
+            if (j == 1) {
                 ny = m->way;
-                nw = mw - 2 * c->c_border;
-                nh = m->wah - 2 * c->c_border;
-            } else {            /* tile window */
-                if (j == 1) {
-                    ny = m->way;
-                    nx += mc->w + 2 * mc->c_border;
-                    nw = m->waw - mw - 2 * c->c_border;
-                }
-                if (j + 1 == n) /* remainder */
-                    nh = (m->way + m->wah) - ny - 2 * c->c_border;
-                else
-                    nh = th - 2 * c->c_border;
+                nx += mc->w + 2 * mc->c_border;
+                nw = m->waw - mw - 2 * c->c_border;
             }
-            fprintf(stderr, "tile(%d, %d, %d, %d)\n", nx, ny, nw, nh);
-            resize(c, nx, ny, nw, nh, RESIZEHINTS);
-            if ((RESIZEHINTS)
-                && ((c->h < bh) || (c->h > nh) || (c->w < bh)
-                    || (c->w > nw)))
-                /*
-                 * client doesn't accept size constraints 
-                 */
-                resize(c, nx, ny, nw, nh, False);
-            if (n > 1 && th != m->wah)
-                ny = c->y + c->h + 2 * c->c_border;
-
-            j++;
+            if (j + 1 == n)     /* remainder */
+                nh = (m->way + m->wah) - ny - 2 * c->c_border;
+            else
+                nh = th - 2 * c->c_border;
         }
+        fprintf(stderr, "tile(%d, %d, %d, %d)\n", nx, ny, nw, nh);
+        layout_place(c, workspace, nx, ny, nw, nh, False);
+        if (n > 1 && th != m->wah)
+            ny = c->y + c->h + 2 * c->c_border;
+
+        j++;
     }
     fprintf(stderr, "done\n");
 }
@@ -679,30 +1872,333 @@ layoutTile(void)
 void
 fn_toggleBar(const char *arg)
 {
+    Monitor *m = &monitors[monitorat()];
+
     if (bpos == BarOff)
         bpos = (BARPOS == BarOff) ? BarTop : BARPOS;
     else
         bpos = BarOff;
-    updatebarpos(&monitors[monitorat()]);
-    arrange();
+    updatebarpos(m);
+    monitor_arrange(m);
 }
 
 unsigned int
-textnw(Monitor * m, const char *text, unsigned int len)
+textnw(DCFont * font, const char *text, unsigned int len)
 {
     XRectangle r;
+#ifdef XFT
+    XGlyphInfo gi;
 
-    if (m->dc.font.set) {
-        XmbTextExtents(m->dc.font.set, text, len, NULL, &r);
+    /*
+     * computed from Xft's client side glyph cache, no round trip 
+     */
+    if (font->xft) {
+        XftTextExtentsUtf8(bdpy, font->xft, (const FcChar8 *) text, len, &gi);
+        return gi.xOff;
+    }
+#endif
+    if (font->set) {
+        XmbTextExtents(font->set, text, len, NULL, &r);
         return r.width;
     }
-    return XTextWidth(m->dc.font.xfont, text, len);
+    return XTextWidth(font->xfont, text, len);
 }
 
 unsigned int
-textw(Monitor * m, const char *text)
+textw(DCFont * font, const char *text)
+{
+    return textnw(font, text, strlen(text)) + font->height;
+}
+
+#ifdef IMAGEBAR
+/*
+ * Client side bar rasterization. The bar of a monitor is rendered into an
+ * XImage in our own memory and presented with a single XShmPutImage (or
+ * XPutImage when MIT-SHM isn't usable, e.g. on a remote display) per
+ * redraw. Glyph coverage is rendered once from the Xft font's FreeType
+ * face and cached with the font; fills are plain 32 bit row stores which the
+ * compiler vectorizes. Only 8 bit per channel TrueColor visuals are
+ * handled, anything else keeps using the server side path.
+ */
+Bool shmfailed;
+
+int
+xerrorshm(Display * dsply, XErrorEvent * ee)
+{
+    shmfailed = True;
+    return 0;
+}
+
+void
+img_free(Monitor * m)
+{
+    if (!m->dc.img)
+        return;
+#ifdef XSHM
+    if (m->dc.shm) {
+        XShmDetach(bdpy, &m->dc.shminfo);
+        XSync(bdpy, False);
+        shmdt(m->dc.shminfo.shmaddr);
+        m->dc.img->data = NULL;
+    }
+#endif
+    XDestroyImage(m->dc.img);
+    m->dc.img = NULL;
+}
+
+#ifdef XSHM
+Bool
+img_initShm(Monitor * m, Visual * vis, int depth)
+{
+    int shmid;
+    XImage *img;
+
+    if (!XShmQueryExtension(bdpy))
+        return False;
+    img = XShmCreateImage(bdpy, vis, depth, ZPixmap, NULL, &m->dc.shminfo,
+                          m->m_width, bh);
+    if (!img)
+        return False;
+    if (img->bits_per_pixel != 32) {
+        XDestroyImage(img);
+        return False;
+    }
+    shmid = shmget(IPC_PRIVATE, img->bytes_per_line * img->height,
+                   IPC_CREAT | 0600);
+    if (shmid == -1) {
+        XDestroyImage(img);
+        return False;
+    }
+    img->data = m->dc.shminfo.shmaddr = shmat(shmid, NULL, 0);
+    shmctl(shmid, IPC_RMID, NULL);      /* gone once both sides detach */
+    if (img->data == (char *) -1) {
+        img->data = NULL;
+        XDestroyImage(img);
+        return False;
+    }
+    m->dc.shminfo.shmid = shmid;
+    m->dc.shminfo.readOnly = False;
+
+    /*
+     * attaching fails asynchronously if the server can't see our memory 
+     */
+    shmfailed = False;
+    XSync(bdpy, False);
+    XSetErrorHandler(xerrorshm);
+    XShmAttach(bdpy, &m->dc.shminfo);
+    XSync(bdpy, False);
+    XSetErrorHandler(xerror);
+    if (shmfailed) {
+        shmdt(m->dc.shminfo.shmaddr);
+        img->data = NULL;
+        XDestroyImage(img);
+        return False;
+    }
+    m->dc.img = img;
+    m->dc.shm = True;
+    return True;
+}
+#endif
+
+void
+img_init(Monitor * m)
+{
+    Visual *vis = DefaultVisual(bdpy, m->m_screen);
+    int depth = DefaultDepth(bdpy, m->m_screen);
+
+    m->dc.img = NULL;
+    m->dc.shm = False;
+    if (!m->dc.font->xft || vis->class != TrueColor
+        || vis->red_mask != 0xff0000 || vis->green_mask != 0xff00
+        || vis->blue_mask != 0xff)
+        return;
+#ifdef XSHM
+    if (img_initShm(m, vis, depth))
+        return;
+#endif
+    m->dc.img = XCreateImage(bdpy, vis, depth, ZPixmap, 0, NULL, m->m_width,
+                             bh, 32, 0);
+    if (!m->dc.img)
+        return;
+    if (m->dc.img->bits_per_pixel != 32) {
+        XDestroyImage(m->dc.img);
+        m->dc.img = NULL;
+        return;
+    }
+    m->dc.img->data = emallocz(m->dc.img->bytes_per_line * bh);
+}
+
+void
+img_freeGlyphs(DCFont * font)
+{
+    unsigned int i;
+
+    for (i = 0; i < font->glyphcap; i++)
+        free(font->glyphs[i].g_alpha);
+    free(font->glyphs);
+    font->glyphs = NULL;
+    font->nglyphs = font->glyphcap = 0;
+}
+
+BarGlyph *
+img_lookupGlyph(BarGlyph * glyphs, unsigned int cap, unsigned int key)
+{
+    unsigned int i = (key * 2654435761U) & (cap - 1);
+
+    while (glyphs[i].g_key && glyphs[i].g_key != key)
+        i = (i + 1) & (cap - 1);
+    return &glyphs[i];
+}
+
+BarGlyph *
+img_glyph(DCFont * font, FT_UInt index)
+{
+    unsigned int i, x, y, cap;
+    BarGlyph *g, *old;
+    FT_Face face;
+    FT_Bitmap *bm;
+    XGlyphInfo gi;
+
+    if (font->nglyphs * 2 >= font->glyphcap) {
+        old = font->glyphs;
+        cap = font->glyphcap ? font->glyphcap * 2 : 256;
+        font->glyphs = emallocz(cap * sizeof(BarGlyph));
+        for (i = 0; i < font->glyphcap; i++)
+            if (old[i].g_key)
+                *img_lookupGlyph(font->glyphs, cap, old[i].g_key) = old[i];
+        free(old);
+        font->glyphcap = cap;
+    }
+    g = img_lookupGlyph(font->glyphs, font->glyphcap, index + 1);
+    if (g->g_key)
+        return g;
+
+    /*
+     * cache miss, rasterize the glyph once 
+     */
+    g->g_key = index + 1;
+    font->nglyphs++;
+    XftGlyphExtents(bdpy, font->xft, &index, 1, &gi);
+    g->g_advance = gi.xOff;
+    if (!(face = XftLockFace(font->xft)))
+        return g;
+    if (!FT_Load_Glyph(face, index, FT_LOAD_RENDER | FT_LOAD_TARGET_NORMAL)) {
+        bm = &face->glyph->bitmap;
+        g->g_left = face->glyph->bitmap_left;
+        g->g_top = face->glyph->bitmap_top;
+        g->g_width = bm->width;
+        g->g_rows = bm->rows;
+        g->g_alpha = emallocz(g->g_width * g->g_rows + 1);
+        for (y = 0; y < bm->rows; y++)
+            for (x = 0; x < bm->width; x++) {
+                unsigned char *row = bm->buffer + y * bm->pitch;
+                g->g_alpha[y * g->g_width + x] =
+                    (bm->pixel_mode == FT_PIXEL_MODE_MONO)
+                    ? ((row[x >> 3] & (0x80 >> (x & 7))) ? 255 : 0)
+                    : row[x];
+            }
+    }
+    XftUnlockFace(font->xft);
+    return g;
+}
+
+void
+img_fill(Monitor * m, int x, int y, int w, int h, unsigned long pixel)
+{
+    int i;
+    uint32_t *row;
+    XImage *img = m->dc.img;
+
+    if (x < 0) {
+        w += x;
+        x = 0;
+    }
+    if (y < 0) {
+        h += y;
+        y = 0;
+    }
+    if (x + w > img->width)
+        w = img->width - x;
+    if (y + h > img->height)
+        h = img->height - y;
+    if (w <= 0 || h <= 0)
+        return;
+    row = (uint32_t *) (img->data + y * img->bytes_per_line) + x;
+    for (i = 0; i < w; i++)
+        row[i] = pixel;
+    for (i = 1; i < h; i++)
+        memcpy((char *) row + i * img->bytes_per_line, row,
+               w * sizeof(uint32_t));
+}
+
+void
+img_text(Monitor * m, int x, int y, const char *text, int len,
+         unsigned long pixel)
+{
+    int l, gx, gy, px, py;
+    unsigned int a, sr, sg, sb, d;
+    FcChar32 ucs;
+    BarGlyph *g;
+    uint32_t *dst;
+    XImage *img = m->dc.img;
+
+    sr = (pixel >> 16) & 0xff;
+    sg = (pixel >> 8) & 0xff;
+    sb = pixel & 0xff;
+    while (len > 0 && (l = FcUtf8ToUcs4((const FcChar8 *) text, &ucs, len)) > 0) {
+        text += l;
+        len -= l;
+        g = img_glyph(m->dc.font, XftCharIndex(bdpy, m->dc.font->xft, ucs));
+        for (gy = 0; gy < g->g_rows; gy++) {
+            py = y - g->g_top + gy;
+            if (py < 0 || py >= img->height)
+                continue;
+            dst = (uint32_t *) (img->data + py * img->bytes_per_line);
+            for (gx = 0; gx < g->g_width; gx++) {
+                px = x + g->g_left + gx;
+                if (px < 0 || px >= img->width)
+                    continue;
+                if (!(a = g->g_alpha[gy * g->g_width + gx]))
+                    continue;
+                if (a == 255) {
+                    dst[px] = pixel;
+                    continue;
+                }
+                d = dst[px];
+                dst[px] = ((sr * a + ((d >> 16) & 0xff) * (255 - a)) / 255) << 16
+                    | ((sg * a + ((d >> 8) & 0xff) * (255 - a)) / 255) << 8
+                    | ((sb * a + (d & 0xff) * (255 - a)) / 255);
+            }
+        }
+        x += g->g_advance;
+    }
+}
+
+void
+img_put(Monitor * m, Window win, int w, int h)
+{
+#ifdef XSHM
+    if (m->dc.shm) {
+        XShmPutImage(bdpy, win, m->dc.gc, m->dc.img, 0, 0, 0, 0, w, h,
+                     False);
+        return;
+    }
+#endif
+    XPutImage(bdpy, win, m->dc.gc, m->dc.img, 0, 0, 0, 0, w, h);
+}
+#endif
+
+void
+fillrect(Monitor * m, XRectangle * r, unsigned long pixel)
 {
-    return textnw(m, text, strlen(text)) + m->dc.font.height;
+#ifdef IMAGEBAR
+    if (m->dc.img) {
+        img_fill(m, r->x, r->y, r->width, r->height, pixel);
+        return;
+    }
+#endif
+    XSetForeground(bdpy, m->dc.gc, pixel);
+    XFillRectangles(bdpy, m->dc.drawable, m->dc.gc, r, 1);
 }
 
 void
@@ -713,20 +2209,37 @@ drawsquare(Monitor * m, Bool filled, Bool empty, Bool invert,
     XGCValues gcv;
     XRectangle r = { m->dc.x, m->dc.y, m->dc.w, m->dc.h };
 
-    gcv.foreground = col[invert ? ColBG : ColFG];
-    XChangeGC(dpy, m->dc.gc, GCForeground, &gcv);
-    x = (m->dc.font.ascent + m->dc.font.descent + 2) / 4;
+    x = (m->dc.font->ascent + m->dc.font->descent + 2) / 4;
     r.x = m->dc.x + 1;
     r.y = m->dc.y + 1;
     if (filled) {
         r.width = r.height = x + 1;
-        XFillRectangles(dpy, m->dc.drawable, m->dc.gc, &r, 1);
+        fillrect(m, &r, col[invert ? ColBG : ColFG]);
     } else if (empty) {
         r.width = r.height = x;
-        XDrawRectangles(dpy, m->dc.drawable, m->dc.gc, &r, 1);
+#ifdef IMAGEBAR
+        if (m->dc.img) {
+            img_fill(m, r.x, r.y, x + 1, 1, col[invert ? ColBG : ColFG]);
+            img_fill(m, r.x, r.y + x, x + 1, 1, col[invert ? ColBG : ColFG]);
+            img_fill(m, r.x, r.y, 1, x + 1, col[invert ? ColBG : ColFG]);
+            img_fill(m, r.x + x, r.y, 1, x + 1, col[invert ? ColBG : ColFG]);
+            return;
+        }
+#endif
+        gcv.foreground = col[invert ? ColBG : ColFG];
+        XChangeGC(bdpy, m->dc.gc, GCForeground, &gcv);
+        XDrawRectangles(bdpy, m->dc.drawable, m->dc.gc, &r, 1);
     }
 }
 
+#ifdef XFT
+XftColor *
+xftcolor(Monitor * m, unsigned long col[ColLast], int idx)
+{
+    return (col == m->dc.sel) ? &m->dc.xftsel[idx] : &m->dc.xftnorm[idx];
+}
+#endif
+
 void
 drawtext(Monitor * m, const char *text, unsigned long col[ColLast],
          Bool invert)
@@ -736,8 +2249,7 @@ drawtext(Monitor * m, const char *text, unsigned long col[ColLast],
     unsigned int len, olen;
     XRectangle r = { m->dc.x, m->dc.y, m->dc.w, m->dc.h };
 
-    XSetForeground(dpy, m->dc.gc, col[invert ? ColFG : ColBG]);
-    XFillRectangles(dpy, m->dc.drawable, m->dc.gc, &r, 1);
+    fillrect(m, &r, col[invert ? ColFG : ColBG]);
     if (!text)
         return;
     w = 0;
@@ -746,13 +2258,13 @@ drawtext(Monitor * m, const char *text, unsigned long col[ColLast],
         len = sizeof buf - 1;
     memcpy(buf, text, len);
     buf[len] = 0;
-    h = m->dc.font.ascent + m->dc.font.descent;
-    y = m->dc.y + (m->dc.h / 2) - (h / 2) + m->dc.font.ascent;
+    h = m->dc.font->ascent + m->dc.font->descent;
+    y = m->dc.y + (m->dc.h / 2) - (h / 2) + m->dc.font->ascent;
     x = m->dc.x + (h / 2);
     /*
      * shorten text if necessary 
      */
-    while (len && (w = textnw(m, buf, len)) > m->dc.w - h)
+    while (len && (w = textnw(m->dc.font, buf, len)) > m->dc.w - h)
         buf[--len] = 0;
     if (len < olen) {
         if (len > 1)
@@ -764,79 +2276,319 @@ drawtext(Monitor * m, const char *text, unsigned long col[ColLast],
     }
     if (w > m->dc.w)
         return;                 /* too long */
-    XSetForeground(dpy, m->dc.gc, col[invert ? ColBG : ColFG]);
-    if (m->dc.font.set)
-        XmbDrawString(dpy, m->dc.drawable, m->dc.font.set, m->dc.gc, x, y,
+#ifdef IMAGEBAR
+    if (m->dc.img) {
+        img_text(m, x, y, buf, len, col[invert ? ColBG : ColFG]);
+        return;
+    }
+#endif
+#ifdef XFT
+    /*
+     * glyphs are uploaded to the server once, after that only glyph
+     * indices are sent 
+     */
+    if (m->dc.font->xft) {
+        XftDrawStringUtf8(m->dc.xftdraw, xftcolor(m, col, invert ? ColBG : ColFG),
+                          m->dc.font->xft, x, y, (const FcChar8 *) buf, len);
+        return;
+    }
+#endif
+    XSetForeground(bdpy, m->dc.gc, col[invert ? ColBG : ColFG]);
+    if (m->dc.font->set)
+        XmbDrawString(bdpy, m->dc.drawable, m->dc.font->set, m->dc.gc, x, y,
                       buf, len);
     else
-        XDrawString(dpy, m->dc.drawable, m->dc.gc, x, y, buf, len);
+        XDrawString(bdpy, m->dc.drawable, m->dc.gc, x, y, buf, len);
 }
 
-Bool
-isoccupied(unsigned int monitor, unsigned int t)
-{
-    return True;
-}
+/*
+ * Everything a bar shows, copied out of the window manager state so it can
+ * be rendered without looking at clients, workspaces or the config. 
+ */
+typedef struct {
+    int         bm_workspace;
+    unsigned int bm_occupied;   /* tag masks */
+    unsigned int bm_urgent;
+    Bool        bm_hassel;      /* the focused client is on this monitor */
+    char        bm_symbol[32];
+    Window      bm_barwin;
+    int         bm_width;
+} BarMonitor;
 
-Bool
-isurgent(unsigned int monitor, unsigned int t)
+typedef struct {
+    BarMonitor *b_mon;
+    unsigned int b_nmon, b_cap;
+    int         b_selmonitor;
+    Bool        b_sel;
+    Bool        b_selfloating;
+    char        b_title[512];
+    char        b_stext[sizeof stext];
+    int         b_bh, b_blw;
+} BarSnapshot;
+
+void
+bar_snapshot(BarSnapshot * b)
 {
-    // if(c->c_monitor == monitor && c->isurgent && c->tags[t])
-    return True;
+    int i, n;
+    Client *c = sel;
+    BarMonitor *bm;
+
+    if (b->b_cap < mcount) {
+        free(b->b_mon);
+        b->b_mon = emallocz(mcount * sizeof(BarMonitor));
+        b->b_cap = mcount;
+    }
+    b->b_nmon = mcount;
+    for (i = 0; i < mcount; i++) {
+        Monitor *m = &monitors[i];
+        bm = &b->b_mon[i];
+        fprintf(stderr, "m%d %s\n", i, c ? c->c_title->t_str : "NIL");
+        bm->bm_workspace = m->m_workspace;
+        /*
+         * tag j shows workspace j + 1 
+         */
+        bm->bm_occupied = m->m_occupied >> 1;
+        bm->bm_urgent = m->m_urgent >> 1;
+        bm->bm_hassel = c && c->c_monitor == i;
+        strncpy(bm->bm_symbol, workspaces.w_layout[m->m_workspace]->symbol,
+                sizeof bm->bm_symbol - 1);
+        bm->bm_symbol[sizeof bm->bm_symbol - 1] = '\0';
+        bm->bm_barwin = m->m_barwin;
+        bm->bm_width = m->m_width;
+    }
+    b->b_bh = bh;
+    b->b_blw = blw;
+    b->b_selmonitor = selmonitor;
+    b->b_sel = c != NULL;
+    if (c) {
+        /*
+         * the title is copied with its known length, not formatted 
+         */
+        n = snprintf(b->b_title, sizeof b->b_title, "(%d,%d) ", c->c_xunits,
+                     c->c_yunits);
+        memcpy(b->b_title + n, c->c_title->t_str, c->c_title->t_len + 1);
+        b->b_selfloating = c->c_isfloating;
+    }
+    memcpy(b->b_stext, stext, sizeof stext);
 }
 
+/*
+ * Draws all bars from a snapshot, only touches the draw contexts. The
+ * monitor array itself only changes under barlock. 
+ */
 void
-drawbar(void)
+bar_render(BarSnapshot * b)
 {
-    char text[512];
     int i, j, x;
-    Client *c = NULL;
+    unsigned int flips;
+    Bool urgent, seltag;
+    BarMonitor *bm;
 
-    for (i = 0; i < mcount; i++) {
+    for (i = 0; i < b->b_nmon && i < mcount; i++) {
         Monitor *m = &monitors[i];
+        bm = &b->b_mon[i];
         m->dc.x = 0;
-        c = sel;
-        fprintf(stderr, "m%d %s\n", i, c ? c->c_name : "NIL");
+
+        /*
+         * the tag cells stay in the drawable, only repaint the ones whose
+         * bits flipped 
+         */
+        flips = (bm->bm_occupied ^ m->dc.lastocc) | (bm->bm_urgent ^ m->dc.lasturg);
+        if (!m->dc.valid || bm->bm_hassel != m->dc.lasthassel)
+            flips = ~0;
         for (j = 0; j < LENGTH(tags); j++) {
-            m->dc.w = textw(m, tags[j]);
-            if (m->m_workspace == ((j + 1) % 10)) {     /* seltags */
-                drawtext(m, tags[j], m->dc.sel, isurgent(i, j));
-                drawsquare(m, c && c->c_monitor == i,
-                           isoccupied(i, j), isurgent(i, j), m->dc.sel);
+            m->dc.w = m->dc.tagw[j];
+            seltag = bm->bm_workspace == ((j + 1) % 10);
+            if (!((flips >> j) & 1) && seltag == (m->dc.lastws == ((j + 1) % 10))) {
+                m->dc.x += m->dc.w;
+                continue;
+            }
+            urgent = (bm->bm_urgent >> j) & 1;
+            if (seltag) {
+                drawtext(m, tags[j], m->dc.sel, urgent);
+                drawsquare(m, bm->bm_hassel, (bm->bm_occupied >> j) & 1,
+                           urgent, m->dc.sel);
             } else {
-                drawtext(m, tags[j], m->dc.norm, isurgent(i, j));
-                drawsquare(m, c && c->c_monitor == i,
-                           isoccupied(i, j), isurgent(i, j), m->dc.norm);
+                drawtext(m, tags[j], m->dc.norm, urgent);
+                drawsquare(m, bm->bm_hassel, (bm->bm_occupied >> j) & 1,
+                           urgent, m->dc.norm);
             }
             m->dc.x += m->dc.w;
         }
-        m->dc.w = blw;
-        drawtext(m, workspaces.w_layout[m->m_workspace]->symbol, m->dc.norm, False);
+        m->dc.valid = True;
+        m->dc.lastws = bm->bm_workspace;
+        m->dc.lastocc = bm->bm_occupied;
+        m->dc.lasturg = bm->bm_urgent;
+        m->dc.lasthassel = bm->bm_hassel;
+        m->dc.w = b->b_blw;
+        drawtext(m, bm->bm_symbol, m->dc.norm, False);
         x = m->dc.x + m->dc.w;
-        if (i == selmonitor) {
-            m->dc.w = textw(m, stext);
-            m->dc.x = m->m_width - m->dc.w;
+        if (i == b->b_selmonitor) {
+            m->dc.w = textw(m->dc.font, b->b_stext);
+            m->dc.x = bm->bm_width - m->dc.w;
             if (m->dc.x < x) {
                 m->dc.x = x;
-                m->dc.w = m->m_width - x;
+                m->dc.w = bm->bm_width - x;
             }
-            drawtext(m, stext, m->dc.norm, False);
+            drawtext(m, b->b_stext, m->dc.norm, False);
         } else {
-            m->dc.x = m->m_width;
+            m->dc.x = bm->bm_width;
         }
-        if ((m->dc.w = m->dc.x - x) > bh) {
+        if ((m->dc.w = m->dc.x - x) > b->b_bh) {
             m->dc.x = x;
-            if (c) {
-                sprintf(text, "(%d,%d) %s", c->c_xunits, c->c_yunits, c->c_name);
-                drawtext(m, text, m->dc.sel, False);
-                drawsquare(m, False, c->c_isfloating, False, m->dc.sel);
+            if (b->b_sel) {
+                drawtext(m, b->b_title, m->dc.sel, False);
+                drawsquare(m, False, b->b_selfloating, False, m->dc.sel);
             } else
                 drawtext(m, NULL, m->dc.norm, False);
         }
-        XCopyArea(dpy, m->dc.drawable, m->m_barwin, m->dc.gc, 0, 0, m->m_width,
-                  bh, 0, 0);
-        XSync(dpy, False);
+#ifdef IMAGEBAR
+        if (m->dc.img)
+            img_put(m, bm->bm_barwin, bm->bm_width, b->b_bh);
+        else
+#endif
+        XCopyArea(bdpy, m->dc.drawable, bm->bm_barwin, m->dc.gc, 0, 0,
+                  bm->bm_width, b->b_bh, 0, 0);
     }
+    XFlush(bdpy);
+}
+
+#ifdef BARTHREAD
+/*
+ * The bars are drawn by a thread of their own on a second X connection,
+ * so slow fonts or long status text never hold up event handling. The
+ * event thread publishes snapshots through a triple buffer: it fills its
+ * back slot and swaps it with the middle one, the renderer swaps its front
+ * slot with the middle one if that is newer. Neither side ever waits for
+ * the other. The renderer draws at most BARFPS times a second and always
+ * the latest snapshot. Bar resources are only changed by the event thread
+ * on hotplug, reconfiguration and exit; it takes barlock for that, which
+ * the renderer holds while drawing. 
+ */
+#define BARSLOT_NEW	4
+
+BarSnapshot barslots[3];
+unsigned int barback = 0, barfront = 1;
+unsigned int barmiddle = 2;     /* slot index, | BARSLOT_NEW if unseen */
+int barpipe[2] = { -1, -1 };
+Bool barrunning = False;
+pthread_t barthread;
+pthread_mutex_t barlock = PTHREAD_MUTEX_INITIALIZER;
+
+void *
+bar_thread(void *arg)
+{
+    char buf[64];
+    fd_set rd;
+    struct timespec last = { 0, 0 }, next;
+    long frame = 1000000000L / BARFPS;
+
+    while (__atomic_load_n(&barrunning, __ATOMIC_ACQUIRE)) {
+        FD_ZERO(&rd);
+        FD_SET(barpipe[0], &rd);
+        if (select(barpipe[0] + 1, &rd, NULL, NULL, NULL) == -1
+            && errno != EINTR)
+            break;
+        while (read(barpipe[0], buf, sizeof buf) > 0);
+
+        /*
+         * at most one frame per BARFPS period, changes meanwhile are
+         * coalesced into the next snapshot 
+         */
+        next = last;
+        next.tv_nsec += frame;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        if (!(__atomic_load_n(&barmiddle, __ATOMIC_ACQUIRE) & BARSLOT_NEW))
+            continue;
+        barfront = __atomic_exchange_n(&barmiddle, barfront,
+                                       __ATOMIC_ACQ_REL) & ~BARSLOT_NEW;
+        pthread_mutex_lock(&barlock);
+        bar_render(&barslots[barfront]);
+        pthread_mutex_unlock(&barlock);
+        clock_gettime(CLOCK_MONOTONIC, &last);
+    }
+    return NULL;
+}
+
+void
+bar_start(void)
+{
+    if (pipe(barpipe) == -1)
+        EXIT("dwm: cannot create bar pipe\n");
+    fcntl(barpipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(barpipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(barpipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(barpipe[1], F_SETFD, FD_CLOEXEC);
+    barrunning = True;
+    if (pthread_create(&barthread, NULL, bar_thread, NULL))
+        EXIT("dwm: cannot start bar thread\n");
+}
+
+void
+bar_stop(void)
+{
+    if (!barrunning)
+        return;
+    __atomic_store_n(&barrunning, False, __ATOMIC_RELEASE);
+    if (write(barpipe[1], "", 1) == -1 && errno != EAGAIN)
+        fprintf(stderr, "dwm: cannot wake bar thread\n");
+    pthread_join(barthread, NULL);
+    close(barpipe[0]);
+    close(barpipe[1]);
+}
+#endif
+
+/*
+ * Opens the connection the bars are drawn on. 
+ */
+void
+bar_open(void)
+{
+#ifdef BARTHREAD
+    if (!(bdpy = XOpenDisplay(0)))
+        EXIT("dwm: cannot open bar display\n");
+    fcntl(ConnectionNumber(bdpy), F_SETFD, FD_CLOEXEC);
+#else
+    bdpy = dpy;
+#endif
+}
+
+void
+bar_lock(void)
+{
+#ifdef BARTHREAD
+    pthread_mutex_lock(&barlock);
+#endif
+}
+
+void
+bar_unlock(void)
+{
+#ifdef BARTHREAD
+    pthread_mutex_unlock(&barlock);
+#endif
+}
+
+void
+drawbar(void)
+{
+#ifdef BARTHREAD
+    bar_snapshot(&barslots[barback]);
+    barback = __atomic_exchange_n(&barmiddle, barback | BARSLOT_NEW,
+                                  __ATOMIC_ACQ_REL) & ~BARSLOT_NEW;
+    if (write(barpipe[1], "", 1) == -1 && errno != EAGAIN)
+        fprintf(stderr, "dwm: cannot wake bar thread\n");
+#else
+    static BarSnapshot b;
+
+    bar_snapshot(&b);
+    bar_render(&b);
+#endif
 }
 
 /*
@@ -912,6 +2664,13 @@ fn_killSession(const char *arg)
     readin = running = False;
 }
 
+void
+fn_restart(const char *arg)
+{
+    restarting = True;
+    readin = running = False;
+}
+
 
 
 
@@ -957,44 +2716,44 @@ detachstack(Client * c)
 */
 
 
+/*
+ * Mod1 + Button1-3 are grabbed once on the roots, passive grabs activate
+ * on the outermost window first, so they win over the client grabs and
+ * arrive with the client as subwindow. Clients only carry the click to
+ * focus grab while unfocused, a focus change costs two requests. 
+ */
 void
-grabbuttons(Client * c, Bool focused)
+buttons_grab(void)
 {
-    XUngrabButton(dpy, AnyButton, AnyModifier, c->c_win);
+    unsigned int i, j, b;
+    unsigned int mods[] = { 0, LockMask, numlockmask, numlockmask | LockMask };
 
-    if (focused) {
-        XGrabButton(dpy, Button1, Mod1Mask, c->c_win, False, BUTTONMASK,
-                    GrabModeAsync, GrabModeSync, None, None);
-        XGrabButton(dpy, Button1, Mod1Mask | LockMask, c->c_win, False,
-                    BUTTONMASK, GrabModeAsync, GrabModeSync, None, None);
-        XGrabButton(dpy, Button1, Mod1Mask | numlockmask, c->c_win, False,
-                    BUTTONMASK, GrabModeAsync, GrabModeSync, None, None);
-        XGrabButton(dpy, Button1, Mod1Mask | numlockmask | LockMask, c->c_win,
-                    False, BUTTONMASK, GrabModeAsync, GrabModeSync, None,
-                    None);
-
-        XGrabButton(dpy, Button2, Mod1Mask, c->c_win, False, BUTTONMASK,
-                    GrabModeAsync, GrabModeSync, None, None);
-        XGrabButton(dpy, Button2, Mod1Mask | LockMask, c->c_win, False,
-                    BUTTONMASK, GrabModeAsync, GrabModeSync, None, None);
-        XGrabButton(dpy, Button2, Mod1Mask | numlockmask, c->c_win, False,
-                    BUTTONMASK, GrabModeAsync, GrabModeSync, None, None);
-        XGrabButton(dpy, Button2, Mod1Mask | numlockmask | LockMask, c->c_win,
-                    False, BUTTONMASK, GrabModeAsync, GrabModeSync, None,
-                    None);
-
-        XGrabButton(dpy, Button3, Mod1Mask, c->c_win, False, BUTTONMASK,
-                    GrabModeAsync, GrabModeSync, None, None);
-        XGrabButton(dpy, Button3, Mod1Mask | LockMask, c->c_win, False,
-                    BUTTONMASK, GrabModeAsync, GrabModeSync, None, None);
-        XGrabButton(dpy, Button3, Mod1Mask | numlockmask, c->c_win, False,
-                    BUTTONMASK, GrabModeAsync, GrabModeSync, None, None);
-        XGrabButton(dpy, Button3, Mod1Mask | numlockmask | LockMask, c->c_win,
-                    False, BUTTONMASK, GrabModeAsync, GrabModeSync, None,
-                    None);
-    } else
+    if (buttonlockmask == numlockmask)
+        return;
+    buttonlockmask = numlockmask;
+    for (i = 0; i < mcount; i++) {
+        Window root = monitors[i].m_root;
+
+        XUngrabButton(dpy, AnyButton, AnyModifier, root);
+        for (b = Button1; b <= Button3; b++)
+            for (j = 0; j < LENGTH(mods); j++)
+                XGrabButton(dpy, b, Mod1Mask | mods[j], root, False,
+                            BUTTONMASK, GrabModeAsync, GrabModeSync, None,
+                            None);
+    }
+}
+
+void
+grabbuttons(Client * c, Bool focused)
+{
+    if (c->c_grabbed == !focused)
+        return;
+    if (focused)
+        XUngrabButton(dpy, AnyButton, AnyModifier, c->c_win);
+    else
         XGrabButton(dpy, AnyButton, AnyModifier, c->c_win, False, BUTTONMASK,
                     GrabModeAsync, GrabModeSync, None, None);
+    c->c_grabbed = !focused;
 }
 
 void
@@ -1016,9 +2775,11 @@ focus(Client * c)
     if (c) {
         //detachstack(c);
         //attachstack(c);
+        client_flush(c);
         grabbuttons(c, True);
     }
     sel = c;
+    ewmh_markDirty(EWMH_DIRTY_ACTIVE | EWMH_DIRTY_DESKTOP);
     drawbar();
     if (c) {
         XSetWindowBorder(dpy, c->c_win, m->dc.sel[ColBorder]);
@@ -1033,17 +2794,18 @@ focus(Client * c)
 void
 fn_focusNext(const char *arg)
 {
-    int workspace = monitors[selmonitor].m_workspace;
+    Monitor *m = &monitors[selmonitor];
+    int workspace = m->m_workspace;
     Client *c;
 
     TRACE("%s\n", __func__);
-    if (sel)
+    if (sel && sel->c_monitor == selmonitor && sel->c_next[workspace])
         c = sel->c_next[workspace];
     else
-        c = rootClient;
+        c = m->m_clients;
 
-    if (workspaces.w_numClients[workspace] > 0) {
-        for (; c == rootClient; c = c->c_next[workspace]);
+    if (m->m_wsclients[workspace] > 0) {
+        for (; c == m->m_clients; c = c->c_next[workspace]);
     } else {
         c = NULL;
     }
@@ -1055,8 +2817,8 @@ fn_focusNext(const char *arg)
 Client *
 getclient(Window w)
 {
-    Client *c = rootClient->c_next[0];
-    for (; c != rootClient; c = c->c_next[0]) {
+    Client *c = rootClient->c_gnext;
+    for (; c != rootClient; c = c->c_gnext) {
         if (c->c_win == w)
             return c;
     }
@@ -1067,7 +2829,7 @@ Bool
 isvisible(Client * c, int monitor)
 {
     Monitor *m = &monitors[monitor];
-    return c->c_next[m->m_workspace] != NULL;
+    return c->c_monitor == monitor && c->c_next[m->m_workspace] != NULL;
 }
 
 
@@ -1090,69 +2852,76 @@ monitorat()
     return 0;
 }
 
+/*
+ * Size hint solver, constrains w and h to the ICCCM hints of c in a
+ * single pass without touching c or the server. The units are returned
+ * for the caller to keep. 
+ */
 void
-resize(Client * c, int x, int y, int w, int h, Bool sizehints)
+sizehints_solve(const Client * c, int *pw, int *ph, int *xunits, int *yunits)
 {
-    XWindowChanges wc;
-    // Monitor scr = monitors[monitorat()];
-    // c->c_monitor = monitorat();
+    int w = *pw, h = *ph;
 
-    if (sizehints) {
-        /*
-         * set minimum possible 
-         */
-        if (w < 1)
-            w = 1;
-        if (h < 1)
-            h = 1;
+    /*
+     * set minimum possible 
+     */
+    if (w < 1)
+        w = 1;
+    if (h < 1)
+        h = 1;
 
-        /*
-         * temporarily remove base dimensions 
-         */
-        w -= c->c_basew;
-        h -= c->c_baseh;
+    /*
+     * temporarily remove base dimensions 
+     */
+    w -= c->c_basew;
+    h -= c->c_baseh;
 
-        /*
-         * adjust for aspect limits 
-         */
-        if (c->c_minay > 0 && c->c_maxay > 0 && c->c_minax > 0 && c->c_maxax > 0) {
-            if (w * c->c_maxay > h * c->c_maxax)
-                w = h * c->c_maxax / c->c_maxay;
-            else if (w * c->c_minay < h * c->c_minax)
-                h = w * c->c_minay / c->c_minax;
-        }
+    /*
+     * adjust for aspect limits 
+     */
+    if (c->c_minay > 0 && c->c_maxay > 0 && c->c_minax > 0 && c->c_maxax > 0) {
+        if (w * c->c_maxay > h * c->c_maxax)
+            w = h * c->c_maxax / c->c_maxay;
+        else if (w * c->c_minay < h * c->c_minax)
+            h = w * c->c_minay / c->c_minax;
+    }
 
-        /*
-         * adjust for increment value 
-         */
-        c->c_xunits = w / c->c_incw;
-        c->c_yunits = h / c->c_inch;
-        
-        w = c->c_xunits * c->c_incw;
-        h = c->c_yunits * c->c_inch;
-        /*
-        c->c_yunits = h / c->c_inch;
+    /*
+     * adjust for increment value 
+     */
+    *xunits = w / c->c_incw;
+    *yunits = h / c->c_inch;
+    w = *xunits * c->c_incw;
+    h = *yunits * c->c_inch;
 
-        if (c->c_incw)
-            w -= w % c->c_incw;
-        if (c->c_inch)
-            h -= h % c->c_inch;
-*/
-        /*
-         * restore base dimensions 
-         */
-        w += c->c_basew;
-        h += c->c_baseh;
-
-        if (c->c_minw > 0 && w < c->c_minw)
-            w = c->c_minw;
-        if (c->c_minh > 0 && h < c->c_minh)
-            h = c->c_minh;
-        if (c->c_maxw > 0 && w > c->c_maxw)
-            w = c->c_maxw;
-        if (c->c_maxh > 0 && h > c->c_maxh)
-            h = c->c_maxh;
-    }
+    /*
+     * restore base dimensions 
+     */
+    w += c->c_basew;
+    h += c->c_baseh;
+
+    if (c->c_minw > 0 && w < c->c_minw)
+        w = c->c_minw;
+    if (c->c_minh > 0 && h < c->c_minh)
+        h = c->c_minh;
+    if (c->c_maxw > 0 && w > c->c_maxw)
+        w = c->c_maxw;
+    if (c->c_maxh > 0 && h > c->c_maxh)
+        h = c->c_maxh;
+    *pw = w;
+    *ph = h;
+}
+
+void
+resize(Client * c, int x, int y, int w, int h, Bool sizehints)
+{
+    XWindowChanges wc;
+    // Monitor scr = monitors[monitorat()];
+    // c->c_monitor = monitorat();
+
+    if (sizehints)
+        sizehints_solve(c, &w, &h, &c->c_xunits, &c->c_yunits);
+    c->c_stale = False;
     if (w <= 0 || h <= 0)
         return;
     /*
@@ -1176,38 +2945,95 @@ resize(Client * c, int x, int y, int w, int h, Bool sizehints)
         XSync(dpy, False);
     }
 }
+
+/*
+ * restack() keeps the tiled clients directly below the bar of the selected
+ * monitor, the selected one first. stackmodel is the order it last
+ * requested, top down and starting with that bar; as dwm is the only one
+ * restacking tiled clients this is what the server has. The new order is
+ * diffed against it and only the span that changed is sent, as a single
+ * XRestackWindows. Nothing is sent, and no round trip made, when nothing
+ * changed. The client ending up on top of each monitor gets its pending
+ * geometry, see layoutFullscreen(). 
+ */
+Window *stackmodel = NULL, *stackwant = NULL;
+unsigned int nstackmodel = 0, stackcap = 0;
+
 void
 restack(void)
 {
-    unsigned int i;
+    unsigned int i, n = 0, k, e, need;
+    Bool changed = False, top;
     Client *c;
     XEvent ev;
-    XWindowChanges wc;
+    Window *tmp;
 
     drawbar();
-    if (!sel)
-        return;
-    if (sel->c_isfloating)
+    if (sel && sel->c_isfloating) {
         XRaiseWindow(dpy, sel->c_win);
-    wc.stack_mode = Below;
-    wc.sibling = monitors[selmonitor].m_barwin;
-    if (!sel->c_isfloating) {
-        XConfigureWindow(dpy, sel->c_win, CWSibling | CWStackMode, &wc);
-        wc.sibling = sel->c_win;
+        changed = True;
+    }
+
+    need = workspaces.w_numClients[0] + 1;
+    if (stackcap < need) {
+        free(stackmodel);
+        free(stackwant);
+        stackcap = need * 2;
+        stackmodel = emallocz(stackcap * sizeof(Window));
+        stackwant = emallocz(stackcap * sizeof(Window));
+        nstackmodel = 0;        /* forget it, the next one is sent whole */
+    }
+
+    stackwant[n++] = monitors[selmonitor].m_barwin;
+    if (sel && !sel->c_isfloating) {
+        client_flush(sel);
+        stackwant[n++] = sel->c_win;
     }
     for (i = 0; i < mcount; i++) {
+        Client *head = monitors[i].m_clients;
         int workspace = monitors[i].m_workspace;
-        c = rootClient->c_next[workspace];
-        for (; c != rootClient; c = c->c_next[workspace]) {
-            if (c->c_isfloating)
-                continue;
-            if (c == sel)
+
+        top = !sel || sel->c_isfloating || sel->c_monitor != (int) i;
+        c = head->c_next[workspace];
+        for (; c != head; c = c->c_next[workspace]) {
+            if (c->c_isfloating || c == sel)
                 continue;
-            XConfigureWindow(dpy, c->c_win, CWSibling | CWStackMode,
-                             &wc);
-            wc.sibling = c->c_win;
+            if (top) {
+                client_flush(c);
+                top = False;
+            }
+            stackwant[n++] = c->c_win;
+        }
+    }
+
+    for (k = 0; k < n && k < nstackmodel && stackwant[k] == stackmodel[k];
+         k++);
+    if (k < n || n != nstackmodel) {
+        e = n;
+        if (n == nstackmodel)
+            while (e > k && stackwant[e - 1] == stackmodel[e - 1])
+                e--;
+        /*
+         * the window above the span stays put, the rest goes below it 
+         */
+        k = k ? k - 1 : 0;
+        /*
+         * a new first window alone is no span, the next one has to go
+         * below it
+         */
+        if (k == 0 && e == 1 && n > 1)
+            e = 2;
+        if (e - k > 1) {
+            XRestackWindows(dpy, stackwant + k, e - k);
+            changed = True;
         }
+        tmp = stackmodel;
+        stackmodel = stackwant;
+        stackwant = tmp;
+        nstackmodel = n;
     }
+    if (!changed)
+        return;
     XSync(dpy, False);
     while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
 }
@@ -1221,20 +3047,68 @@ fn_nextLayout(const char *arg)
     TRACE("%s\n", __func__);
     if (!arg) {
         workspaces.w_layout[m->m_workspace]++;
-        if (workspaces.w_layout[m->m_workspace] == &layouts[LENGTH(layouts)])
-            workspaces.w_layout[m->m_workspace] = &layouts[0];
+        if (workspaces.w_layout[m->m_workspace] == &cfg->cf_layouts[cfg->cf_nlayouts])
+            workspaces.w_layout[m->m_workspace] = &cfg->cf_layouts[0];
     } else {
-        for (i = 0; i < LENGTH(layouts); i++)
-            if (!strcmp(arg, layouts[i].symbol))
+        for (i = 0; i < cfg->cf_nlayouts; i++)
+            if (!strcmp(arg, cfg->cf_layouts[i].symbol))
                 break;
-        if (i == LENGTH(layouts))
+        if (i == cfg->cf_nlayouts)
             return;
-        workspaces.w_layout[m->m_workspace] = &layouts[i];
+        workspaces.w_layout[m->m_workspace] = &cfg->cf_layouts[i];
     }
-    arrange();
+    ws_arrange(m->m_workspace);
     drawbar();
 }
 
+/*
+ * The adjust actions are bound to keys which are held down, they only
+ * update their state and leave the bar position and layout pending in
+ * m_adjust. run() calls adjust_flush() once the event queue is drained,
+ * which applies them at most ADJUSTFPS times a second. The result is the
+ * same as arranging after every repeat. 
+ */
+Bool adjustpending = False;
+struct timespec adjustlast;
+
+void
+adjust_schedule(Monitor * m, unsigned int what)
+{
+    m->m_adjust |= what;
+    adjustpending = True;
+}
+
+/*
+ * Returns the milliseconds until pending adjustments are due, -1 if
+ * there are none. 
+ */
+int
+adjust_flush(void)
+{
+    struct timespec now;
+    long elapsed, frame = 1000 / ADJUSTFPS;
+    int i;
+
+    if (!adjustpending)
+        return -1;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - adjustlast.tv_sec) * 1000
+        + (now.tv_nsec - adjustlast.tv_nsec) / 1000000;
+    if (elapsed >= 0 && elapsed < frame)
+        return frame - elapsed;
+
+    adjustlast = now;
+    adjustpending = False;
+    for (i = 0; i < mcount; i++)
+        if (monitors[i].m_adjust) {
+            monitor_layout(&monitors[i]);
+            monitors[i].m_adjust = 0;
+        }
+    focus(NULL);
+    restack();
+    return -1;
+}
+
 void
 fn_adjustMonitorWidth(const char *arg)
 {
@@ -1253,8 +3127,7 @@ fn_adjustMonitorWidth(const char *arg)
         else if (m->m_width > m->m_realWidth)
             m->m_width = m->m_realWidth;
     }
-    updatebarpos(m);
-    arrange();
+    adjust_schedule(m, ADJUST_BAR | ADJUST_LAYOUT);
 }
 
 void
@@ -1275,8 +3148,7 @@ fn_adjustMonitorHeight(const char *arg)
         else if (m->m_height > m->m_realHeight)
             m->m_height = m->m_realHeight;
     }
-    updatebarpos(m);
-    arrange();
+    adjust_schedule(m, ADJUST_BAR | ADJUST_LAYOUT);
 }
 
 void
@@ -1284,10 +3156,10 @@ fn_adjustVSplit(const char *arg)
 {
     Monitor *m = &monitors[monitorat()];
     int vsplit = workspaces.w_vSplit[m->m_workspace];
-    int delta;
+    int i, delta;
     
     if (arg == NULL)
-        vsplit = VSPLIT;
+        vsplit = cfg->cf_vsplit;
     else if (sscanf(arg, "%d", &delta) == 1) {
         if (arg[0] == '+' || arg[0] == '-')
             vsplit += delta;
@@ -1300,7 +3172,9 @@ fn_adjustVSplit(const char *arg)
     }
 
     workspaces.w_vSplit[m->m_workspace] = vsplit;
-    arrange();
+    for (i = 0; i < mcount; i++)
+        if (monitors[i].m_workspace == m->m_workspace)
+            adjust_schedule(&monitors[i], ADJUST_LAYOUT);
 }
 
 void
@@ -1309,9 +3183,10 @@ togglefloating(const char *arg)
     if (!sel)
         return;
     sel->c_isfloating = !sel->c_isfloating;
+    ws_touch(sel);
     if (sel->c_isfloating)
         resize(sel, sel->x, sel->y, sel->w, sel->h, True);
-    arrange();
+    monitor_arrange(&monitors[sel->c_monitor]);
 }
 
 void
@@ -1390,10 +3265,18 @@ buttonpress(XEvent * e)
 
     Monitor *m = &monitors[monitorat()];
 
+    /*
+     * clicks through the root grabs, see buttons_grab() 
+     */
+    if (ev->window == ev->root && ev->subwindow != None) {
+        ev->window = ev->subwindow;
+        ev->x = ev->x_root - m->m_xorig;
+    }
+
     if (ev->window == m->m_barwin) {
         x = 0;
         for (i = 0; i < LENGTH(tags); i++) {
-            x += textw(m, tags[i]);
+            x += m->dc.tagw[i];
             if (ev->x < x) {
                 fn_viewWorkspace((const char*)((i+1) % 10));
                 return;
@@ -1424,8 +3307,10 @@ configurerequest(XEvent * e)
 
     if ((c = getclient(ev->window))) {
         Monitor *m = &monitors[c->c_monitor];
-        if (ev->value_mask & CWBorderWidth)
+        if (ev->value_mask & CWBorderWidth) {
             c->c_border = ev->border_width;
+            ws_touch(c);
+        }
 
         if (c->c_isfixed || c->c_isfloating) {
             if (ev->value_mask & CWX)
@@ -1445,7 +3330,7 @@ configurerequest(XEvent * e)
             if ((ev->value_mask & (CWX | CWY))
                 && !(ev->value_mask & (CWWidth | CWHeight)))
                 configure(c);
-            if (isvisible(c, monitorat()))
+            if (isvisible(c, c->c_monitor))
                 XMoveResizeWindow(dpy, c->c_win, c->x, c->y, c->w, c->h);
         } else {
             configure(c);
@@ -1467,21 +3352,9 @@ void
 configurenotify(XEvent * e)
 {
     XConfigureEvent *ev = &e->xconfigure;
-    Monitor *m = &monitors[selmonitor];
 
-    if (ev->window == m->m_root &&
-        (ev->width != m->m_width || ev->height != m->m_height))
-    {
-        m->m_width = ev->width;
-        m->m_height = ev->height;
-        XFreePixmap(dpy, dc.drawable);
-        dc.drawable =
-            XCreatePixmap(dpy, m->m_root, m->m_width, bh,
-                          DefaultDepth(dpy, m->m_screen));
-        XResizeWindow(dpy, m->m_barwin, m->m_width, bh);
-        updatebarpos(m);
+    if (ev->window == monitors[0].m_root && updategeom())
         arrange();
-    }
 }
 
 void
@@ -1530,23 +3403,129 @@ mappingnotify(XEvent * e)
     XMappingEvent *ev = &e->xmapping;
 
     XRefreshKeyboardMapping(ev);
-    if (ev->request == MappingKeyboard)
+    if (ev->request == MappingKeyboard) {
+        keymap_index(&cfg->cf_keys[0]);
+        keymap_index(&cfg->cf_keys[1]);
         keys_grab();
+    }
 }
 
 
+/*********************************
+ * Title Functionality
+ *********************************/
+
 /*
- * Misc Properties.
+ * Client titles are interned: equal titles ("xterm", "bash", ...) share
+ * one refcounted Title, found by hash and length before any bytes are
+ * compared. Titles are carved out of arena blocks and recycled through
+ * free lists per size class. title_set() reports whether the title really
+ * changed, so repeated identical title updates don't repaint the bar. 
  */
+#define TITLE_BUCKETS	1024    /* power of two */
+#define TITLE_CLASS	32
+#define TITLE_BLOCK	16384
+
+Title *titles[TITLE_BUCKETS];
+Title *titlefree[(sizeof(Title) + TITLE_MAXLEN + TITLE_CLASS) / TITLE_CLASS + 1];
+char *titlearena = NULL;
+unsigned int titlearenaleft = 0;
+
+unsigned int
+title_hash(const char *s, unsigned int len)
+{
+    unsigned int h = 2166136261U;
+
+    while (len--)
+        h = (h ^ (unsigned char) *s++) * 16777619U;
+    return h;
+}
+
+Title *
+title_alloc(unsigned int len)
+{
+    unsigned int class = (sizeof(Title) + len + TITLE_CLASS) / TITLE_CLASS;
+    unsigned int size = class * TITLE_CLASS;
+    Title *t;
+
+    if ((t = titlefree[class])) {
+        titlefree[class] = t->t_next;
+        return t;
+    }
+    if (titlearenaleft < size) {
+        titlearena = emallocz(TITLE_BLOCK);
+        titlearenaleft = TITLE_BLOCK;
+    }
+    t = (Title *) titlearena;
+    titlearena += size;
+    titlearenaleft -= size;
+    return t;
+}
+
+Title *
+title_get(const char *s, unsigned int len)
+{
+    unsigned int h;
+    Title *t;
+
+    if (len > TITLE_MAXLEN)
+        len = TITLE_MAXLEN;
+    h = title_hash(s, len);
+    for (t = titles[h & (TITLE_BUCKETS - 1)]; t; t = t->t_next)
+        if (t->t_hash == h && t->t_len == len && !memcmp(t->t_str, s, len)) {
+            t->t_refs++;
+            return t;
+        }
+    t = title_alloc(len);
+    t->t_hash = h;
+    t->t_len = len;
+    t->t_refs = 1;
+    memcpy(t->t_str, s, len);
+    t->t_str[len] = '\0';
+    t->t_next = titles[h & (TITLE_BUCKETS - 1)];
+    titles[h & (TITLE_BUCKETS - 1)] = t;
+    return t;
+}
 
 void
-updatesizehints(Client *c)
+title_put(Title * t)
 {
-    long msize;
-    XSizeHints size;
+    Title **tp;
+    unsigned int class;
+
+    if (!t || --t->t_refs)
+        return;
+    for (tp = &titles[t->t_hash & (TITLE_BUCKETS - 1)]; *tp != t;
+         tp = &(*tp)->t_next);
+    *tp = t->t_next;
+    class = (sizeof(Title) + t->t_len + TITLE_CLASS) / TITLE_CLASS;
+    t->t_next = titlefree[class];
+    titlefree[class] = t;
+}
+
+Bool
+title_set(Title ** tp, const char *s)
+{
+    Title *t = title_get(s, strlen(s));
+
+    if (t == *tp) {
+        t->t_refs--;
+        return False;
+    }
+    title_put(*tp);
+    *tp = t;
+    return True;
+}
+
 
-    if (!XGetWMNormalHints(dpy, c->c_win, &size, &msize) || !size.flags)
-        size.flags = PSize;
+/*
+ * Misc Properties.
+ */
+
+void
+setsizehints(Client *c, XSizeHints *hints)
+{
+    XSizeHints size = *hints;
 
     if (size.flags & PBaseSize) {
         c->c_basew = size.base_width;
@@ -1590,54 +3569,315 @@ updatesizehints(Client *c)
     } else {
         c->c_minax = c->c_maxax = c->c_minay = c->c_maxay = 0;
     }
-
-    c->c_isfixed = (c->c_maxw && c->c_minw && c->c_maxh && c->c_minh
-                  && c->c_maxw == c->c_minw && c->c_maxh == c->c_minh);
+
+    c->c_isfixed = (c->c_maxw && c->c_minw && c->c_maxh && c->c_minh
+                  && c->c_maxw == c->c_minw && c->c_maxh == c->c_minh);
+    ws_touch(c);
+}
+
+Bool
+fetchsizehints(Display * d, Window w, XSizeHints * size)
+{
+    long msize;
+
+    if (!XGetWMNormalHints(d, w, size, &msize) || !size->flags)
+        size->flags = PSize;
+    return True;
+}
+
+void
+updatesizehints(Client *c)
+{
+    XSizeHints size;
+
+    fetchsizehints(dpy, c->c_win, &size);
+    setsizehints(c, &size);
+}
+
+Bool
+gettextprop(Display * d, Window w, Atom atom, char *text, unsigned int size)
+{
+    char **list = NULL;
+    int n;
+    XTextProperty name;
+
+    if (!text || size == 0)
+        return False;
+    text[0] = '\0';
+    XGetTextProperty(d, w, &name, atom);
+    if (!name.nitems)
+        return False;
+    if (name.encoding == XA_STRING)
+        strncpy(text, (char *) name.value, size - 1);
+    else {
+        if (XmbTextPropertyToTextList(d, &name, &list, &n) >= Success
+            && n > 0 && *list) {
+            strncpy(text, *list, size - 1);
+            XFreeStringList(list);
+        }
+    }
+    text[size - 1] = '\0';
+    XFree(name.value);
+    return True;
+}
+
+void
+fetchtitle(Display * d, Window w, char *text, unsigned int size)
+{
+    if (!gettextprop(d, w, netatom[NetWMName], text, size))
+        gettextprop(d, w, wmatom[WMName], text, size);
+}
+
+Bool
+updatetitle(Client *c)
+{
+    char name[TITLE_MAXLEN + 1];
+
+    fetchtitle(dpy, c->c_win, name, sizeof name);
+    return title_set(&c->c_title, name);
+}
+
+/*
+ * Returns -1 if the window has no WM_HINTS, else whether it is urgent. 
+ */
+int
+fetchurgency(Display * d, Window w)
+{
+    XWMHints *wmh;
+    int urgent;
+
+    if (!(wmh = XGetWMHints(d, w)))
+        return -1;
+    urgent = (wmh->flags & XUrgencyHint) ? True : False;
+    XFree(wmh);
+    return urgent;
+}
+
+void
+updatewmhints(Client *c)
+{
+    int urgent;
+
+    if ((urgent = fetchurgency(dpy, c->c_win)) != -1)
+        client_setUrgent(c, urgent);
+}
+
+/*
+ * Property fetching. With -DPROPTHREAD the reads behind propertynotify()
+ * are done by a helper thread on its own X connection, so title updates
+ * of chatty terminals don't cost the event thread a round trip each.
+ * Requests and results travel through two single producer, single
+ * consumer rings; each side is woken by an eventfd, and the helper
+ * sleeps on a third one while the result ring is full. Results name the
+ * window, not the client, and are dropped if the client is gone by the
+ * time run() applies them. When the request ring is full, or without
+ * PROPTHREAD, properties are read synchronously as before. manage() always
+ * reads them synchronously as it needs them at once. 
+ */
+enum { PropTitle, PropSizeHints, PropWMHints };
+
+#ifdef PROPTHREAD
+#define PROPQUEUE	128         /* power of two */
+
+typedef struct {
+    Window      p_win;
+    int         p_kind;
+    int         p_urgent;
+    XSizeHints  p_size;
+    char        p_name[TITLE_MAXLEN + 1];
+} PropMsg;
+
+typedef struct {
+    PropMsg     q_msg[PROPQUEUE];
+    unsigned int q_head;        /* advanced by the consumer */
+    unsigned int q_tail;        /* advanced by the producer */
+} PropQueue;
+
+PropQueue propjobs, propresults;
+int propjobfd = -1, propresultfd = -1, propspacefd = -1;
+int propquit = 0;               /* set by prop_stop(), atomically */
+Display *pdpy;
+pthread_t propthread;
+
+PropMsg *
+propqueue_back(PropQueue * q)
+{
+    if (q->q_tail - __atomic_load_n(&q->q_head, __ATOMIC_ACQUIRE) == PROPQUEUE)
+        return NULL;
+    return &q->q_msg[q->q_tail & (PROPQUEUE - 1)];
+}
+
+void
+propqueue_push(PropQueue * q)
+{
+    __atomic_store_n(&q->q_tail, q->q_tail + 1, __ATOMIC_RELEASE);
+}
+
+PropMsg *
+propqueue_front(PropQueue * q)
+{
+    if (q->q_head == __atomic_load_n(&q->q_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &q->q_msg[q->q_head & (PROPQUEUE - 1)];
+}
+
+void
+propqueue_pop(PropQueue * q)
+{
+    __atomic_store_n(&q->q_head, q->q_head + 1, __ATOMIC_RELEASE);
+}
+
+void
+prop_wake(int fd)
+{
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof one) != sizeof one)
+        fprintf(stderr, "dwm: cannot wake property thread\n");
+}
+
+void *
+prop_thread(void *arg)
+{
+    uint64_t n;
+    PropMsg *job, *res;
+
+    for (;;) {
+        if (read(propjobfd, &n, sizeof n) != sizeof n && errno != EINTR)
+            break;
+        if (__atomic_load_n(&propquit, __ATOMIC_ACQUIRE))
+            break;
+        while ((job = propqueue_front(&propjobs))) {
+            /*
+             * wait for prop_drain() to make room rather than drop a
+             * result, prop_stop() wakes this wait as well 
+             */
+            while (!(res = propqueue_back(&propresults))) {
+                if (__atomic_load_n(&propquit, __ATOMIC_ACQUIRE))
+                    return NULL;
+                if (read(propspacefd, &n, sizeof n) != sizeof n
+                    && errno != EINTR)
+                    return NULL;
+            }
+            res->p_win = job->p_win;
+            res->p_kind = job->p_kind;
+            propqueue_pop(&propjobs);
+            switch (res->p_kind) {
+            case PropTitle:
+                res->p_name[0] = '\0';
+                fetchtitle(pdpy, res->p_win, res->p_name, sizeof res->p_name);
+                break;
+            case PropSizeHints:
+                fetchsizehints(pdpy, res->p_win, &res->p_size);
+                break;
+            case PropWMHints:
+                res->p_urgent = fetchurgency(pdpy, res->p_win);
+                break;
+            }
+            propqueue_push(&propresults);
+            prop_wake(propresultfd);
+        }
+    }
+    return NULL;
 }
 
-Bool
-gettextprop(Window w, Atom atom, char *text, unsigned int size)
+void
+prop_start(void)
 {
-    char **list = NULL;
-    int n;
-    XTextProperty name;
-
-    if (!text || size == 0)
-        return False;
-    text[0] = '\0';
-    XGetTextProperty(dpy, w, &name, atom);
-    if (!name.nitems)
-        return False;
-    if (name.encoding == XA_STRING)
-        strncpy(text, (char *) name.value, size - 1);
-    else {
-        if (XmbTextPropertyToTextList(dpy, &name, &list, &n) >= Success
-            && n > 0 && *list) {
-            strncpy(text, *list, size - 1);
-            XFreeStringList(list);
-        }
-    }
-    text[size - 1] = '\0';
-    XFree(name.value);
-    return True;
+    if (!(pdpy = XOpenDisplay(0)))
+        EXIT("dwm: cannot open property display\n");
+    fcntl(ConnectionNumber(pdpy), F_SETFD, FD_CLOEXEC);
+    propjobfd = eventfd(0, EFD_CLOEXEC);
+    propresultfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    propspacefd = eventfd(0, EFD_CLOEXEC);
+    if (propjobfd == -1 || propresultfd == -1 || propspacefd == -1)
+        EXIT("dwm: cannot create eventfd\n");
+    if (pthread_create(&propthread, NULL, prop_thread, NULL))
+        EXIT("dwm: cannot start property thread\n");
 }
 
+/*
+ * Nothing drains the results any more, so the helper is told to quit
+ * instead of being sent a job; it checks the flag in both of its waits. 
+ */
 void
-updatetitle(Client *c)
+prop_stop(void)
 {
-    if (!gettextprop(c->c_win, netatom[NetWMName], c->c_name, sizeof c->c_name))
-        gettextprop(c->c_win, wmatom[WMName], c->c_name, sizeof c->c_name);
+    if (propjobfd == -1)
+        return;
+    __atomic_store_n(&propquit, 1, __ATOMIC_RELEASE);
+    prop_wake(propjobfd);
+    prop_wake(propspacefd);
+    pthread_join(propthread, NULL);
+    close(propjobfd);
+    close(propresultfd);
+    close(propspacefd);
+    propjobfd = propresultfd = propspacefd = -1;
+    __atomic_store_n(&propquit, 0, __ATOMIC_RELEASE);
+    propjobs.q_head = propjobs.q_tail = 0;
+    propresults.q_head = propresults.q_tail = 0;
+    XCloseDisplay(pdpy);
 }
 
+/*
+ * Applies the fetched properties, called by run() on propresultfd. 
+ */
 void
-updatewmhints(Client *c)
+prop_drain(void)
 {
-    XWMHints *wmh;
+    uint64_t n;
+    Bool redraw = False, popped = False;
+    PropMsg *res;
+    Client *c;
 
-    if ((wmh = XGetWMHints(dpy, c->c_win))) {
-        c->c_isurgent = (wmh->flags & XUrgencyHint) ? True : False;
-        XFree(wmh);
+    if (read(propresultfd, &n, sizeof n) == -1 && errno != EAGAIN)
+        return;
+    while ((res = propqueue_front(&propresults))) {
+        if ((c = getclient(res->p_win))) {
+            switch (res->p_kind) {
+            case PropTitle:
+                if (title_set(&c->c_title, res->p_name))
+                    redraw |= c == sel;
+                break;
+            case PropSizeHints:
+                setsizehints(c, &res->p_size);
+                break;
+            case PropWMHints:
+                if (res->p_urgent != -1)
+                    client_setUrgent(c, res->p_urgent);
+                redraw = True;
+                break;
+            }
+        }
+        propqueue_pop(&propresults);
+        popped = True;
     }
+    if (popped)
+        prop_wake(propspacefd);
+    if (redraw)
+        drawbar();
+}
+#endif
+
+/*
+ * Queues a property read, False if the caller has to read it itself. 
+ */
+Bool
+prop_request(Client * c, int kind)
+{
+#ifdef PROPTHREAD
+    PropMsg *job;
+
+    if (propjobfd == -1 || !(job = propqueue_back(&propjobs)))
+        return False;
+    job->p_win = c->c_win;
+    job->p_kind = kind;
+    propqueue_push(&propjobs);
+    prop_wake(propjobfd);
+    return True;
+#else
+    return False;
+#endif
 }
 
 void
@@ -1656,20 +3896,24 @@ propertynotify(XEvent * e)
         case XA_WM_TRANSIENT_FOR:
             XGetTransientForHint(dpy, c->c_win, &trans);
             if (!c->c_isfloating
-                && (c->c_isfloating = (getclient(trans) != NULL)))
-                arrange();
+                && (c->c_isfloating = (getclient(trans) != NULL))) {
+                ws_touch(c);
+                monitor_arrange(&monitors[c->c_monitor]);
+            }
             break;
         case XA_WM_NORMAL_HINTS:
-            updatesizehints(c);
+            if (!prop_request(c, PropSizeHints))
+                updatesizehints(c);
             break;
         case XA_WM_HINTS:
-            updatewmhints(c);
-            drawbar();
+            if (!prop_request(c, PropWMHints)) {
+                updatewmhints(c);
+                drawbar();
+            }
             break;
         }
         if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) {
-            updatetitle(c);
-            if (c == sel)
+            if (!prop_request(c, PropTitle) && updatetitle(c) && c == sel)
                 drawbar();
         }
     }
@@ -1699,6 +3943,7 @@ manage(Window w, XWindowAttributes * wa)
 
     c = emallocz(sizeof(Client));
     c->c_win = w;
+    c->c_monitor = selmonitor;
 
     m = &monitors[c->c_monitor];
 
@@ -1720,7 +3965,7 @@ manage(Window w, XWindowAttributes * wa)
             c->x = m->wax;
         if (c->y < m->way)
             c->y = m->way;
-        c->c_border = BORDERPX;
+        c->c_border = cfg->cf_borderpx;
     }
     wc.border_width = c->c_border;
     XConfigureWindow(dpy, w, CWBorderWidth, &wc);
@@ -1742,18 +3987,29 @@ manage(Window w, XWindowAttributes * wa)
     if (!c->c_isfloating)
         c->c_isfloating = (rettrans == Success) || c->c_isfixed;
     //attachstack(c);
+    client_attach(c);
     ws_attach(c, 0);
-    ws_attach(c, monitors[selmonitor].m_workspace);
+    ws_attach(c, m->m_workspace);
+    ewmh_addClient(c);
     XMoveResizeWindow(dpy, c->c_win, c->x, c->y, c->w, c->h);     /* some
                                                                  * windows 
                                                                  * * * * *
                                                                  * require
                                                                  * * * *
                                                                  * this */
-    ban(c);
-    XMapWindow(dpy, c->c_win);
-    setclientstate(c, NormalState);
-    arrange();
+    if (BANMODE == BanUnmap) {
+        /*
+         * the real map state is the ban state, arrange() maps it if visible 
+         */
+        c->c_isbanned = (wa->map_state != IsViewable);
+        if (!c->c_isbanned)
+            setclientstate(c, NormalState);
+    } else {
+        ban(c);
+        XMapWindow(dpy, c->c_win);
+        setclientstate(c, NormalState);
+    }
+    monitor_arrange(m);
 }
 
 void
@@ -1774,6 +4030,7 @@ void
 unmanage(Client *c)
 {
     XWindowChanges wc;
+    Monitor *m = &monitors[c->c_monitor];
 
     /*
      * The server grab construct avoids race conditions. 
@@ -1782,16 +4039,19 @@ unmanage(Client *c)
     XSetErrorHandler(xerrordummy);
     XConfigureWindow(dpy, c->c_win, CWBorderWidth, &wc);  /* restore c_border */
     ws_detachAll(c);
+    client_detach(c);
+    ewmh_removeClient(c);
     //detachstack(c);
     if (sel == c)
         focus(NULL);
     XUngrabButton(dpy, AnyButton, AnyModifier, c->c_win);
     setclientstate(c, WithdrawnState);
+    title_put(c->c_title);
     free(c);
     XSync(dpy, False);
     XSetErrorHandler(xerror);
     XUngrabServer(dpy);
-    arrange();
+    monitor_arrange(m);
 }
 
 void
@@ -1800,8 +4060,24 @@ unmapnotify(XEvent * e)
     Client *c;
     XUnmapEvent *ev = &e->xunmap;
 
-    if ((c = getclient(ev->window)))
+    if ((c = getclient(ev->window))) {
+        /*
+         * a synthetic unmap is the ICCCM withdraw of a client which may
+         * already be unmapped, e.g. banned. Real unmaps are reported on
+         * the client and on the root, only look at the former. 
+         */
+        if (ev->send_event) {
+            unmanage(c);
+            return;
+        }
+        if (ev->event != ev->window)
+            return;
+        if (c->c_ignoreunmap > 0) {
+            c->c_ignoreunmap--;
+            return;
+        }
         unmanage(c);
+    }
 }
 
 void
@@ -1837,6 +4113,7 @@ movemouse(Client * c)
     unsigned int dui;
     Window dummy;
     XEvent ev;
+    TraceRecord tr;
 
     ocx = nx = c->x;
     ocy = ny = c->y;
@@ -1850,9 +4127,12 @@ movemouse(Client * c)
         XMaskEvent(dpy,
                    MOUSEMASK | ExposureMask | SubstructureRedirectMask,
                    &ev);
+        evtrace_begin(&tr, &ev, TRACE_MOVE);
         switch (ev.type) {
         case ButtonRelease:
             XUngrabPointer(dpy, CurrentTime);
+            client_toMonitor(c, monitorat());
+            evtrace_end(&tr);
             return;
         case ConfigureRequest:
         case Expose:
@@ -1864,17 +4144,17 @@ movemouse(Client * c)
             nx = ocx + (ev.xmotion.x - x1);
             ny = ocy + (ev.xmotion.y - y1);
             Monitor *m = &monitors[monitorat()];
-            if (abs(m->wax - nx) < SNAP)
+            if (abs(m->wax - nx) < cfg->cf_snap)
                 nx = m->wax;
             else if (abs((m->wax + m->waw) - (nx + c->w + 2 * c->c_border)) <
-                     SNAP)
+                     cfg->cf_snap)
                 nx = m->wax + m->waw - c->w - 2 * c->c_border;
-            if (abs(m->way - ny) < SNAP)
+            if (abs(m->way - ny) < cfg->cf_snap)
                 ny = m->way;
             else if (abs((m->way + m->wah) - (ny + c->h + 2 * c->c_border)) <
-                     SNAP)
+                     cfg->cf_snap)
                 ny = m->way + m->wah - c->h - 2 * c->c_border;
-            if ((abs(nx - c->x) > SNAP) || (abs(ny - c->y) > SNAP))
+            if ((abs(nx - c->x) > cfg->cf_snap) || (abs(ny - c->y) > cfg->cf_snap))
                 togglefloating(NULL);
             if (c->c_isfloating)
                 resize(c, nx, ny, c->w, c->h, False);
@@ -1884,6 +4164,7 @@ movemouse(Client * c)
              */
             break;
         }
+        evtrace_end(&tr);
     }
 }
 
@@ -1893,6 +4174,7 @@ resizemouse(Client * c)
     int ocx, ocy;
     int nw, nh;
     XEvent ev;
+    TraceRecord tr;
 
     ocx = c->x;
     ocy = c->y;
@@ -1907,12 +4189,15 @@ resizemouse(Client * c)
         XMaskEvent(dpy,
                    MOUSEMASK | ExposureMask | SubstructureRedirectMask,
                    &ev);
+        evtrace_begin(&tr, &ev, TRACE_RESIZE);
         switch (ev.type) {
         case ButtonRelease:
             XWarpPointer(dpy, None, c->c_win, 0, 0, 0, 0,
                          c->w + c->c_border - 1, c->h + c->c_border - 1);
             XUngrabPointer(dpy, CurrentTime);
             while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+            client_toMonitor(c, monitorat());
+            evtrace_end(&tr);
             return;
         case ConfigureRequest:
         case Expose:
@@ -1925,12 +4210,13 @@ resizemouse(Client * c)
                 nw = 1;
             if ((nh = ev.xmotion.y - ocy - 2 * c->c_border + 1) <= 0)
                 nh = 1;
-            if (abs(nw - c->w) > SNAP || abs(nh - c->h) > SNAP)
+            if (abs(nw - c->w) > cfg->cf_snap || abs(nh - c->h) > cfg->cf_snap)
                 togglefloating(NULL);
             if (c->c_isfloating)
                 resize(c, c->x, c->y, nw, nh, True);
             break;
         }
+        evtrace_end(&tr);
     }
 }
 
@@ -1955,14 +4241,21 @@ xerrorstart(Display * dsply, XErrorEvent * ee)
 void
 checkotherwm(void)
 {
-    otherwm = False;
+    int tries = (restorefd != -1) ? 20 : 1;
+    struct timespec ts = { 0, 50 * 1000 * 1000 };
+
     XSetErrorHandler(xerrorstart);
 
     /*
-     * this causes an error if some other window manager is running 
+     * this causes an error if some other window manager is running; after
+     * a restart the server may not have noticed yet that our previous
+     * incarnation's connection is gone 
      */
-    XSelectInput(dpy, DefaultRootWindow(dpy), SubstructureRedirectMask);
-    XSync(dpy, False);
+    do {
+        otherwm = False;
+        XSelectInput(dpy, DefaultRootWindow(dpy), SubstructureRedirectMask);
+        XSync(dpy, False);
+    } while (otherwm && --tries > 0 && nanosleep(&ts, NULL) == 0);
     if (otherwm) {
         EXIT("dwm: another window manager is already running\n");
     }
@@ -1973,77 +4266,662 @@ checkotherwm(void)
     XSync(dpy, False);
 }
 
+/*
+ * Colors. On TrueColor visuals a pixel value is just the color's channels
+ * shifted into the visual's masks, so "#rgb" style specs are parsed and
+ * turned into pixels locally. Only color names and colormapped visuals go
+ * to the server. Results are cached per screen, a theme reusing a color
+ * costs nothing.
+ */
+typedef struct ColorCache ColorCache;
+struct ColorCache {
+    ColorCache *cc_next;
+    int         cc_screen;
+    unsigned long cc_pixel;
+    XColor      cc_color;
+    char       *cc_name;
+};
+
+ColorCache *colorcache = NULL;
+
+Bool
+parsecolor(const char *colstr, XColor * color)
+{
+    int i, n, digits;
+    unsigned int v;
+    unsigned short *chan[3] = { &color->red, &color->green, &color->blue };
+
+    if (colstr[0] != '#')
+        return False;
+    n = strlen(colstr + 1);
+    if (n != 3 && n != 6 && n != 9 && n != 12)
+        return False;
+    digits = n / 3;
+    for (i = 0; i < 3; i++) {
+        char buf[5];
+
+        memcpy(buf, colstr + 1 + i * digits, digits);
+        buf[digits] = '\0';
+        if (strspn(buf, "0123456789abcdefABCDEF") != digits)
+            return False;
+        v = strtoul(buf, NULL, 16);
+        /*
+         * same left aligned scaling XParseColor() does 
+         */
+        *chan[i] = v << (16 - 4 * digits);
+    }
+    color->flags = DoRed | DoGreen | DoBlue;
+    return True;
+}
+
 unsigned long
-getcolor(const char *colstr, int screen)
+maskcolor(unsigned short value, unsigned long mask)
+{
+    int shift = 0, bits = 0;
+
+    if (!mask)
+        return 0;
+    while (!((mask >> shift) & 1))
+        shift++;
+    while ((mask >> (shift + bits)) & 1)
+        bits++;
+    return ((unsigned long) (value >> (16 - bits)) << shift) & mask;
+}
+
+ColorCache *
+lookupcolor(const char *colstr, int screen)
 {
-    Colormap cmap = DefaultColormap(dpy, screen);
+    ColorCache *cc;
+    Visual *vis = DefaultVisual(dpy, screen);
     XColor color;
 
-    if (!XAllocNamedColor(dpy, cmap, colstr, &color, &color))
+    for (cc = colorcache; cc; cc = cc->cc_next)
+        if (cc->cc_screen == screen && !strcmp(cc->cc_name, colstr))
+            return cc;
+
+    if (vis->class == TrueColor && parsecolor(colstr, &color)) {
+        color.pixel = maskcolor(color.red, vis->red_mask)
+            | maskcolor(color.green, vis->green_mask)
+            | maskcolor(color.blue, vis->blue_mask);
+    } else if (!XAllocNamedColor(dpy, DefaultColormap(dpy, screen), colstr,
+                                 &color, &color))
         EXIT("error, cannot allocate color '%s'\n", colstr);
-    return color.pixel;
+
+    cc = emallocz(sizeof(ColorCache));
+    cc->cc_screen = screen;
+    cc->cc_pixel = color.pixel;
+    cc->cc_color = color;
+    cc->cc_name = emallocz(strlen(colstr) + 1);
+    strcpy(cc->cc_name, colstr);
+    cc->cc_next = colorcache;
+    colorcache = cc;
+    return cc;
+}
+
+unsigned long
+getcolor(const char *colstr, int screen)
+{
+    return lookupcolor(colstr, screen)->cc_pixel;
+}
+
+#ifdef XFT
+void
+getxftcolor(const char *colstr, int screen, XftColor * color)
+{
+    ColorCache *cc = lookupcolor(colstr, screen);
+    XRenderColor rc;
+
+    /*
+     * local on TrueColor visuals 
+     */
+    rc.red = cc->cc_color.red;
+    rc.green = cc->cc_color.green;
+    rc.blue = cc->cc_color.blue;
+    rc.alpha = 0xffff;
+    if (!XftColorAllocValue(dpy, DefaultVisual(dpy, screen),
+                            DefaultColormap(dpy, screen), &rc, color))
+        EXIT("error, cannot allocate xft color '%s'\n", colstr);
 }
+#endif
 
 void
-initfont(Monitor * m, const char *fontstr)
+initfont(DCFont * font, int screen, const char *fontstr)
 {
     char *def, **missing;
     int i, n;
 
+#ifdef XFT
+    if (font->xft)
+        XftFontClose(bdpy, font->xft);
+    if ((font->xft = XftFontOpenXlfd(bdpy, screen, fontstr))
+        || (font->xft = XftFontOpenName(bdpy, screen, fontstr))) {
+        font->ascent = font->xft->ascent;
+        font->descent = font->xft->descent;
+        font->height = font->ascent + font->descent;
+        return;
+    }
+    fprintf(stderr, "dwm: cannot load xft font '%s', using core fonts\n",
+            fontstr);
+#endif
     missing = NULL;
-    if (m->dc.font.set)
-        XFreeFontSet(dpy, m->dc.font.set);
-    m->dc.font.set = XCreateFontSet(dpy, fontstr, &missing, &n, &def);
+    if (font->set)
+        XFreeFontSet(bdpy, font->set);
+    font->set = XCreateFontSet(bdpy, fontstr, &missing, &n, &def);
     if (missing) {
         while (n--)
             fprintf(stderr, "dwm: missing fontset: %s\n", missing[n]);
         XFreeStringList(missing);
     }
-    if (m->dc.font.set) {
+    if (font->set) {
         XFontSetExtents *font_extents;
         XFontStruct **xfonts;
         char **font_names;
-        m->dc.font.ascent = m->dc.font.descent = 0;
-        font_extents = XExtentsOfFontSet(m->dc.font.set);
-        n = XFontsOfFontSet(m->dc.font.set, &xfonts, &font_names);
-        for (i = 0, m->dc.font.ascent = 0, m->dc.font.descent = 0; i < n;
+        font->ascent = font->descent = 0;
+        font_extents = XExtentsOfFontSet(font->set);
+        n = XFontsOfFontSet(font->set, &xfonts, &font_names);
+        for (i = 0, font->ascent = 0, font->descent = 0; i < n;
              i++) {
-            if (m->dc.font.ascent < (*xfonts)->ascent)
-                m->dc.font.ascent = (*xfonts)->ascent;
-            if (m->dc.font.descent < (*xfonts)->descent)
-                m->dc.font.descent = (*xfonts)->descent;
+            if (font->ascent < (*xfonts)->ascent)
+                font->ascent = (*xfonts)->ascent;
+            if (font->descent < (*xfonts)->descent)
+                font->descent = (*xfonts)->descent;
             xfonts++;
         }
     } else {
-        if (m->dc.font.xfont)
-            XFreeFont(dpy, m->dc.font.xfont);
-        m->dc.font.xfont = NULL;
-        if (!(m->dc.font.xfont = XLoadQueryFont(dpy, fontstr))
-            && !(m->dc.font.xfont = XLoadQueryFont(dpy, "fixed")))
+        if (font->xfont)
+            XFreeFont(bdpy, font->xfont);
+        font->xfont = NULL;
+        if (!(font->xfont = XLoadQueryFont(bdpy, fontstr))
+            && !(font->xfont = XLoadQueryFont(bdpy, "fixed")))
             EXIT("error, cannot load font: '%s'\n", fontstr);
-        m->dc.font.ascent = m->dc.font.xfont->ascent;
-        m->dc.font.descent = m->dc.font.xfont->descent;
+        font->ascent = font->xfont->ascent;
+        font->descent = font->xfont->descent;
+    }
+    font->height = font->ascent + font->descent;
+}
+
+/*
+ * Monitors are (re)configured by updategeom(), at startup and whenever the
+ * screen layout changes (RandR notification or a root ConfigureNotify).
+ * The new head list is diffed against the current one: only heads whose
+ * geometry changed get their bar resized, new heads get a bar, and removed
+ * heads hand their clients over to the first monitor without those being
+ * re-managed.
+ */
+/*
+ * Fonts, colors, the GC and the text widths derived from them only depend
+ * on the X screen, so every monitor (Xinerama head) of a screen shares one
+ * refcounted ScreenRes. Only the bar window and its pixmap are per monitor.
+ */
+ScreenRes *screenres = NULL;
+
+void
+screenres_setColors(ScreenRes * r, Bool realloc)
+{
+    int i, j;
+    unsigned long *pix[2] = { r->r_norm, r->r_sel };
+#ifdef XFT
+    XftColor *xpix[2] = { r->r_xftnorm, r->r_xftsel };
+#endif
+
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < ColLast; j++) {
+            pix[i][j] = getcolor(cfg->cf_colors[i][j], r->r_screen);
+#ifdef XFT
+            if (!r->r_font.xft)
+                continue;
+            if (realloc)
+                XftColorFree(dpy, DefaultVisual(dpy, r->r_screen),
+                             DefaultColormap(dpy, r->r_screen), &xpix[i][j]);
+            getxftcolor(cfg->cf_colors[i][j], r->r_screen, &xpix[i][j]);
+#endif
+        }
+    }
+}
+
+void
+screenres_measureLayouts(ScreenRes * r)
+{
+    unsigned int i, w;
+
+    for (r->r_blw = i = 0; i < cfg->cf_nlayouts; i++) {
+        w = textw(&r->r_font, cfg->cf_layouts[i].symbol);
+        if (w > r->r_blw)
+            r->r_blw = w;
+    }
+}
+
+ScreenRes *
+screenres_get(int screen)
+{
+    unsigned int i;
+    ScreenRes *r;
+
+    for (r = screenres; r; r = r->r_next) {
+        if (r->r_screen == screen) {
+            r->r_refs++;
+            return r;
+        }
+    }
+
+    r = emallocz(sizeof(ScreenRes));
+    r->r_screen = screen;
+    r->r_refs = 1;
+
+    /*
+     * init appearance 
+     */
+    initfont(&r->r_font, screen, FONT);
+    screenres_setColors(r, False);
+    r->r_gc = XCreateGC(bdpy, RootWindow(bdpy, screen), 0, 0);
+    XSetLineAttributes(bdpy, r->r_gc, 1, LineSolid, CapButt, JoinMiter);
+    if (r->r_font.xfont)
+        XSetFont(bdpy, r->r_gc, r->r_font.xfont->fid);
+
+    /*
+     * init layout symbol and tag widths 
+     */
+    r->r_tagw = emallocz(LENGTH(tags) * sizeof(unsigned int));
+    for (i = 0; i < LENGTH(tags); i++)
+        r->r_tagw[i] = textw(&r->r_font, tags[i]);
+    screenres_measureLayouts(r);
+
+    r->r_next = screenres;
+    screenres = r;
+    return r;
+}
+
+void
+screenres_put(ScreenRes * r)
+{
+#ifdef XFT
+    int i;
+#endif
+    ScreenRes **rp;
+
+    if (--r->r_refs > 0)
+        return;
+    for (rp = &screenres; *rp != r; rp = &(*rp)->r_next);
+    *rp = r->r_next;
+
+#ifdef IMAGEBAR
+    img_freeGlyphs(&r->r_font);
+#endif
+#ifdef XFT
+    if (r->r_font.xft) {
+        for (i = 0; i < ColLast; i++) {
+            XftColorFree(dpy, DefaultVisual(dpy, r->r_screen),
+                         DefaultColormap(dpy, r->r_screen), &r->r_xftnorm[i]);
+            XftColorFree(dpy, DefaultVisual(dpy, r->r_screen),
+                         DefaultColormap(dpy, r->r_screen), &r->r_xftsel[i]);
+        }
+        XftFontClose(bdpy, r->r_font.xft);
+    } else
+#endif
+    if (r->r_font.set)
+        XFreeFontSet(bdpy, r->r_font.set);
+    else
+        XFreeFont(bdpy, r->r_font.xfont);
+    XFreeGC(bdpy, r->r_gc);
+    free(r->r_tagw);
+    free(r);
+}
+
+/*
+ * Swaps in a freshly parsed configuration. 
+ */
+void
+config_apply(Config * new)
+{
+    int i, w;
+    unsigned int j;
+    Bool recolor = False, relayout = False, rearrange = False;
+    Config *old = cfg;
+    ScreenRes *r;
+    Client *c;
+
+    keymap_index(&new->cf_keys[0]);
+    keymap_index(&new->cf_keys[1]);
+    keys_regrab(&old->cf_keys[0], &new->cf_keys[0]);
+
+    for (i = 0; i < 2; i++)
+        for (j = 0; j < ColLast; j++)
+            if (strcmp(old->cf_colors[i][j], new->cf_colors[i][j]))
+                recolor = True;
+    if (old->cf_nlayouts != new->cf_nlayouts)
+        relayout = rearrange = True;
+    for (j = 0; !relayout && j < new->cf_nlayouts; j++) {
+        if (strcmp(old->cf_layouts[j].symbol, new->cf_layouts[j].symbol))
+            relayout = True;
+        if (old->cf_layouts[j].arrange != new->cf_layouts[j].arrange)
+            rearrange = True;
+    }
+
+    /*
+     * workspaces keep the layout at the same position 
+     */
+    for (w = 0; w < 10; w++) {
+        i = workspaces.w_layout[w] - old->cf_layouts;
+        if (i >= new->cf_nlayouts)
+            i = new->cf_nlayouts - 1;
+        workspaces.w_layout[w] = &new->cf_layouts[i];
+    }
+    cfg = new;
+    config_free(old);
+
+    bar_lock();
+    if (recolor) {
+        for (r = screenres; r; r = r->r_next)
+            screenres_setColors(r, True);
+        for (i = 0; i < mcount; i++)
+            monitors[i].dc.valid = False;
+        c = rootClient->c_gnext;
+        for (; c != rootClient; c = c->c_gnext)
+            XSetWindowBorder(dpy, c->c_win, c == sel
+                             ? monitors[c->c_monitor].dc.sel[ColBorder]
+                             : monitors[c->c_monitor].dc.norm[ColBorder]);
+    }
+    if (relayout) {
+        for (r = screenres; r; r = r->r_next)
+            screenres_measureLayouts(r);
+        blw = monitors[0].dc.res->r_blw;
+    }
+    bar_unlock();
+    if (rearrange || relayout)
+        arrange();
+    else if (recolor)
+        drawbar();
+}
+
+char *configpath = NULL;
+int configwatchfd = -1;
+
+void
+config_load(void)
+{
+    char *home;
+    Config *c;
+
+    config_default();
+    if (getenv("DWMRC")) {
+        configpath = getenv("DWMRC");
+    } else if (CONFIGFILE && (home = getenv("HOME"))) {
+        configpath = emallocz(strlen(home) + strlen(CONFIGFILE) + 2);
+        sprintf(configpath, "%s/%s", home, CONFIGFILE);
+    }
+    if (configpath && (c = config_parse(configpath)))
+        cfg = c;
+}
+
+void
+config_watch(void)
+{
+#ifdef __linux__
+    char *dir, *slash;
+
+    if (!configpath)
+        return;
+    if ((configwatchfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+        return;
+    /*
+     * watch the directory, editors tend to replace the file 
+     */
+    dir = emallocz(strlen(configpath) + 2);
+    strcpy(dir, configpath);
+    if ((slash = strrchr(dir, '/')))
+        slash[slash == dir ? 1 : 0] = '\0';
+    else
+        strcpy(dir, ".");
+    if (inotify_add_watch(configwatchfd, dir,
+                          IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        close(configwatchfd);
+        configwatchfd = -1;
+    }
+    free(dir);
+#endif
+}
+
+void
+config_watchEvent(void)
+{
+#ifdef __linux__
+    char buf[4096], *p, *base;
+    ssize_t len;
+    Bool reload = False;
+    Config *c;
+    struct inotify_event *ev;
+
+    base = strrchr(configpath, '/') ? strrchr(configpath, '/') + 1 : configpath;
+    while ((len = read(configwatchfd, buf, sizeof buf)) > 0) {
+        for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (struct inotify_event *) p;
+            if (ev->len && !strcmp(ev->name, base))
+                reload = True;
+        }
+    }
+    if (reload && (c = config_parse(configpath))) {
+        fprintf(stderr, "dwm: reloaded %s\n", configpath);
+        config_apply(c);
+    }
+#endif
+}
+
+void
+monitor_initBar(Monitor * m)
+{
+    XSetWindowAttributes wa;
+
+    m->dc.res = screenres_get(m->m_screen);
+    m->dc.norm = m->dc.res->r_norm;
+    m->dc.sel = m->dc.res->r_sel;
+    m->dc.gc = m->dc.res->r_gc;
+    m->dc.font = &m->dc.res->r_font;
+    m->dc.tagw = m->dc.res->r_tagw;
+#ifdef XFT
+    m->dc.xftnorm = m->dc.res->r_xftnorm;
+    m->dc.xftsel = m->dc.res->r_xftsel;
+#endif
+    m->dc.h = bh = m->dc.font->height + 2;
+    blw = m->dc.res->r_blw;
+
+    wa.override_redirect = 1;
+    wa.background_pixmap = ParentRelative;
+    wa.event_mask = ButtonPressMask | ExposureMask;
+
+    /*
+     * init bars 
+     */
+    m->m_barwin = XCreateWindow(dpy, m->m_root, m->m_xorig, m->m_yorig, m->m_width, bh, 0,
+                              DefaultDepth(dpy, m->m_screen),
+                              CopyFromParent, DefaultVisual(dpy,
+                                                            m->m_screen),
+                              CWOverrideRedirect | CWBackPixmap |
+                              CWEventMask, &wa);
+    XDefineCursor(dpy, m->m_barwin, cursor[CurNormal]);
+    updatebarpos(m);
+    XMapRaised(dpy, m->m_barwin);
+    m->dc.drawable = XCreatePixmap(bdpy, m->m_root, m->m_width, bh,
+                                   DefaultDepth(dpy, m->m_screen));
+#ifdef XFT
+    if (m->dc.font->xft)
+        m->dc.xftdraw = XftDrawCreate(bdpy, m->dc.drawable,
+                                      DefaultVisual(dpy, m->m_screen),
+                                      DefaultColormap(dpy, m->m_screen));
+#endif
+#ifdef IMAGEBAR
+    img_init(m);
+#endif
+    m->dc.valid = False;
+#ifdef BARTHREAD
+    /*
+     * the window has to exist before the bar connection draws into it 
+     */
+    XSync(dpy, False);
+#endif
+}
+
+void
+monitor_resizeBar(Monitor * m)
+{
+    XFreePixmap(bdpy, m->dc.drawable);
+    m->dc.drawable = XCreatePixmap(bdpy, m->m_root, m->m_width, bh,
+                                   DefaultDepth(dpy, m->m_screen));
+#ifdef XFT
+    if (m->dc.xftdraw)
+        XftDrawChange(m->dc.xftdraw, m->dc.drawable);
+#endif
+#ifdef IMAGEBAR
+    if (m->dc.img) {
+        img_free(m);
+        img_init(m);
+    }
+#endif
+    m->dc.valid = False;
+    XResizeWindow(dpy, m->m_barwin, m->m_width, bh);
+    updatebarpos(m);
+}
+
+void
+monitor_freeBar(Monitor * m)
+{
+#ifdef IMAGEBAR
+    img_free(m);
+#endif
+#ifdef XFT
+    if (m->dc.xftdraw)
+        XftDrawDestroy(m->dc.xftdraw);
+    m->dc.xftdraw = NULL;
+#endif
+    XFreePixmap(bdpy, m->dc.drawable);
+    XDestroyWindow(dpy, m->m_barwin);
+    screenres_put(m->dc.res);
+    m->dc.res = NULL;
+}
+
+Bool
+updategeom(void)
+{
+    int i, j, n = 1, oldcount = mcount;
+    int x, y, w, h;
+    Bool dirty = False;
+    Monitor *m;
+    Client *c;
+    XineramaScreenInfo *info = NULL;
+
+    bar_lock();
+
+    if ((isxinerama = XineramaIsActive(dpy)))
+        info = XineramaQueryScreens(dpy, &n);
+    if (!info || n < 1)
+        n = 1;
+
+    if (n > oldcount) {
+        if (!(monitors = realloc(monitors, n * sizeof(Monitor))))
+            EXIT("fatal: could not realloc() %u bytes\n",
+                 (unsigned int) (n * sizeof(Monitor)));
+        memset(&monitors[oldcount], 0, (n - oldcount) * sizeof(Monitor));
+    }
+
+    /*
+     * removed heads, their clients move over to the first monitor 
+     */
+    for (i = n; i < oldcount; i++) {
+        fprintf(stderr, "monitor[%d]: removed\n", i);
+        monitor_freeBar(&monitors[i]);
+        dirty = True;
+    }
+    if (n < oldcount) {
+        c = rootClient->c_gnext;
+        for (; c != rootClient; c = c->c_gnext) {
+            if (c->c_monitor < n)
+                continue;
+            client_setMonitor(c, 0);
+            if (c->c_isfloating)
+                c->c_migrated = True;
+        }
+        for (i = n; i < oldcount; i++) {
+            free(monitors[i].m_clients);
+            monitors[i].m_clients = NULL;
+        }
+        if (selmonitor >= n)
+            selmonitor = 0;
+    }
+    mcount = n;
+
+    for (i = 0; i < n; i++) {
+        m = &monitors[i];
+        if (info && isxinerama) {
+            x = info[i].x_org;
+            y = info[i].y_org;
+            w = info[i].width;
+            h = info[i].height;
+        } else {
+            x = y = 0;
+            w = DisplayWidth(dpy, isxinerama ? 0 : i);
+            h = DisplayHeight(dpy, isxinerama ? 0 : i);
+        }
+        if (i < oldcount && m->m_realXOrig == x && m->m_realYOrig == y
+            && m->m_realWidth == w && m->m_realHeight == h)
+            continue;
+
+        m->m_realXOrig = m->m_xorig = x;
+        m->m_realYOrig = m->m_yorig = y;
+        m->m_realWidth = m->m_width = w;
+        m->m_realHeight = m->m_height = h;
+        fprintf(stderr, "monitor[%d]: %d,%d,%d,%d\n",
+                i, m->m_xorig, m->m_yorig, m->m_width, m->m_height);
+
+        if (i < oldcount) {
+            monitor_resizeBar(m);
+        } else {
+            m->m_workspace = 1;
+            m->m_clients = c = emallocz(sizeof(Client));
+            for (j = 0; j < 10; j++)
+                c->c_next[j] = c->c_prev[j] = c;
+            m->m_screen = isxinerama ? 0 : i;
+            m->m_root = RootWindow(dpy, m->m_screen);
+            monitor_initBar(m);
+        }
+        dirty = True;
+    }
+    if (info)
+        XFree(info);
+
+    /*
+     * floating clients of removed heads are moved into the first one once
+     * its geometry is known 
+     */
+    m = &monitors[0];
+    c = rootClient->c_gnext;
+    for (; c != rootClient; c = c->c_gnext) {
+        if (!c->c_migrated)
+            continue;
+        c->c_migrated = False;
+        resize(c, m->wax, m->way, c->w, c->h, False);
     }
-    m->dc.font.height = m->dc.font.ascent + m->dc.font.descent;
+    bar_unlock();
+    return dirty;
 }
 
 void
 setup(void)
 {
-    unsigned int i, j, k;
+    unsigned int i;
     Monitor *m;
     XSetWindowAttributes wa;
-    XineramaScreenInfo *info = NULL;
+    char *atomnames[] = { WMATOMS(ATOM_NAME) NETATOMS(ATOM_NAME) };
+    Atom atoms[WMLast + NetLast];
+#ifdef XRANDR
+    int rrerrbase;
+#endif
 
     /*
-     * init atoms 
+     * init atoms, all of them in a single round trip 
      */
-    wmatom[WMProtocols] = XInternAtom(dpy, "WM_PROTOCOLS", False);
-    wmatom[WMDelete] = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
-    wmatom[WMName] = XInternAtom(dpy, "WM_NAME", False);
-    wmatom[WMState] = XInternAtom(dpy, "WM_STATE", False);
-    netatom[NetSupported] = XInternAtom(dpy, "_NET_SUPPORTED", False);
-    netatom[NetWMName] = XInternAtom(dpy, "_NET_WM_NAME", False);
+    if (!XInternAtoms(dpy, atomnames, LENGTH(atomnames), False, atoms))
+        EXIT("dwm: cannot intern atoms\n");
+    memcpy(wmatom, atoms, sizeof wmatom);
+    memcpy(netatom, atoms + WMLast, sizeof netatom);
 
     /*
      * init cursors 
@@ -2052,104 +4930,33 @@ setup(void)
     cursor[CurResize] = XCreateFontCursor(dpy, XC_sizing);
     cursor[CurMove] = XCreateFontCursor(dpy, XC_fleur);
 
+    /*
+     * compiled in and runtime configuration 
+     */
+    config_load();
+    config_watch();
+    keymap_index(&cfg->cf_keys[0]);
+    keymap_index(&cfg->cf_keys[1]);
+
+    rootClient->c_gnext = rootClient->c_gprev = rootClient;
     for (i = 0; i < 10; i++) {
         workspaces.w_numClients[i] = 0;
-        workspaces.w_client.c_next[i] = rootClient;
-        workspaces.w_client.c_prev[i] = rootClient;
-        workspaces.w_vSplit[i] = VSPLIT;
-        workspaces.w_layout[i] = &layouts[0];
+        workspaces.w_vSplit[i] = cfg->cf_vsplit;
+        workspaces.w_layout[i] = &cfg->cf_layouts[0];
     }
         
     // init screens/monitors first
-    mcount = 1;
-    if ((isxinerama = XineramaIsActive(dpy))) {
-        info = XineramaQueryScreens(dpy, &mcount);
-    }
-    monitors = emallocz(mcount * sizeof(Monitor));
+    // TODO: bpos per screen?
+    bpos = BARPOS;
+    strcpy(stext, "dwm-" VERSION);
+    mcount = 0;
+    monitors = NULL;
+    bar_open();
+    updategeom();
 
     for (i = 0; i < mcount; i++) {
-        /*
-         * init geometry 
-         */
         m = &monitors[i];
 
-        m->m_workspace = 1;
-        m->m_screen = isxinerama ? 0 : i;
-        m->m_root = RootWindow(dpy, m->m_screen);
-
-        if (mcount != 1 && isxinerama) {
-            m->m_realXOrig = info[i].x_org;
-            m->m_realYOrig = info[i].y_org;
-            m->m_realWidth = info[i].width;
-            m->m_realWidth = info[i].height;
-        } else {
-            m->m_realXOrig = m->m_realYOrig = 0;
-            m->m_realWidth = DisplayWidth(dpy, m->m_screen);
-            m->m_realHeight = DisplayHeight(dpy, m->m_screen);
-        }
-
-        m->m_xorig = m->m_realXOrig;
-        m->m_yorig = m->m_realYOrig;
-        m->m_width = m->m_realWidth;
-        m->m_height = m->m_realHeight;
-        fprintf(stderr, "monitor[%d]: %d,%d,%d,%d\n",
-                i, m->m_xorig, m->m_yorig, m->m_width, m->m_height);
-
-        /*
-         * init appearance 
-         */
-        m->dc.norm[ColBorder] = getcolor(NORMBORDERCOLOR, m->m_screen);
-        m->dc.norm[ColBG] = getcolor(NORMBGCOLOR, m->m_screen);
-        m->dc.norm[ColFG] = getcolor(NORMFGCOLOR, m->m_screen);
-        m->dc.sel[ColBorder] = getcolor(SELBORDERCOLOR, m->m_screen);
-        m->dc.sel[ColBG] = getcolor(SELBGCOLOR, m->m_screen);
-        m->dc.sel[ColFG] = getcolor(SELFGCOLOR, m->m_screen);
-        initfont(m, FONT);
-        m->dc.h = bh = m->dc.font.height + 2;
-
-        /*
-         * init layouts 
-         */
-        for (blw = k = 0; k < LENGTH(layouts); k++) {
-            j = textw(m, layouts[k].symbol);
-            if (j > blw)
-                blw = j;
-        }
-
-        // TODO: bpos per screen?
-        bpos = BARPOS;
-        wa.override_redirect = 1;
-        wa.background_pixmap = ParentRelative;
-        wa.event_mask = ButtonPressMask | ExposureMask;
-
-        /*
-         * init bars 
-         */
-        m->m_barwin = XCreateWindow(dpy, m->m_root, m->m_xorig, m->m_yorig, m->m_width, bh, 0,
-                                  DefaultDepth(dpy, m->m_screen),
-                                  CopyFromParent, DefaultVisual(dpy,
-                                                                m->m_screen),
-                                  CWOverrideRedirect | CWBackPixmap |
-                                  CWEventMask, &wa);
-        XDefineCursor(dpy, m->m_barwin, cursor[CurNormal]);
-        updatebarpos(m);
-        XMapRaised(dpy, m->m_barwin);
-        strcpy(stext, "dwm-" VERSION);
-        m->dc.drawable = XCreatePixmap(dpy, m->m_root, m->m_width, bh,
-                                       DefaultDepth(dpy, m->m_screen));
-        m->dc.gc = XCreateGC(dpy, m->m_root, 0, 0);
-        XSetLineAttributes(dpy, m->dc.gc, 1, LineSolid, CapButt,
-                           JoinMiter);
-        if (!m->dc.font.set)
-            XSetFont(dpy, m->dc.gc, m->dc.font.xfont->fid);
-
-        /*
-         * EWMH support per monitor 
-         */
-        XChangeProperty(dpy, m->m_root, netatom[NetSupported], XA_ATOM, 32,
-                        PropModeReplace, (unsigned char *) netatom,
-                        NetLast);
-
         /*
          * select for events 
          */
@@ -2158,14 +4965,34 @@ setup(void)
         XChangeWindowAttributes(dpy, m->m_root, CWEventMask | CWCursor, &wa);
         XSelectInput(dpy, m->m_root, wa.event_mask);
     }
-    if (info)
-        XFree(info);
+
+#ifdef XRANDR
+    /*
+     * get told about monitor hotplug 
+     */
+    if (XRRQueryExtension(dpy, &rrevbase, &rrerrbase))
+        XRRSelectInput(dpy, monitors[0].m_root, RRScreenChangeNotifyMask);
+    else
+        rrevbase = -1;
+#endif
+
+    /*
+     * EWMH support 
+     */
+    ewmh_setup();
 
     /*
      * grab keys 
      */
     keys_grab();
 
+#ifdef BARTHREAD
+    bar_start();
+#endif
+#ifdef PROPTHREAD
+    prop_start();
+#endif
+
     selmonitor = monitorat();
     fprintf(stderr, "selmonitor == %d\n", selmonitor);
 }
@@ -2203,7 +5030,8 @@ scan(void)
         wins = NULL;
         if (XQueryTree(dpy, m->m_root, &d1, &d2, &wins, &num)) {
             for (j = 0; j < num; j++) {
-                if (!XGetWindowAttributes(dpy, wins[j], &wa) ||
+                if (getclient(wins[j]) ||
+                    !XGetWindowAttributes(dpy, wins[j], &wa) ||
                     wa.override_redirect ||
                     XGetTransientForHint(dpy, wins[j], &d1)) {
                     continue;
@@ -2215,7 +5043,8 @@ scan(void)
                 }
             }
             for (j = 0; j < num; j++) { /* now the transients */
-                if (!XGetWindowAttributes(dpy, wins[j], &wa)) {
+                if (getclient(wins[j]) ||
+                    !XGetWindowAttributes(dpy, wins[j], &wa)) {
                     continue;
                 }
                 if (XGetTransientForHint(dpy, wins[j], &d1) &&
@@ -2230,35 +5059,709 @@ scan(void)
     }
 }
 
+/*
+ * Live restart. fn_restart() ends run(), restart() then writes the complete
+ * WM state to an unlinked temporary file and execs dwm again, handing over
+ * the descriptor with -r. The new process adopts the clients straight from
+ * the snapshot instead of scan()ning and managing every window again, so
+ * workspace membership, layouts, splits and focus survive the restart and
+ * everything is arranged only once.
+ */
+#define STATE_MAGIC     0x64776d32      /* "dwm2" */
+
+typedef struct {
+    unsigned int s_magic;
+    int         s_mcount;
+    int         s_selmonitor;
+    Window      s_sel;
+    int         s_vsplit[10];
+    int         s_layout[10];
+    int         s_nclients;
+} StateHeader;
+
+typedef struct {
+    int         sm_workspace;
+    int         sm_width, sm_height;
+} StateMonitor;
+
+typedef struct {
+    Window      sc_win;
+    int         sc_x, sc_y, sc_w, sc_h;
+    int         sc_xunits, sc_yunits;
+    int         sc_basew, sc_baseh, sc_incw, sc_inch;
+    int         sc_minw, sc_minh, sc_maxw, sc_maxh;
+    int         sc_minax, sc_minay, sc_maxax, sc_maxay;
+    unsigned    sc_border;
+    Bool        sc_isbanned, sc_isfixed, sc_isfloating, sc_isurgent;
+    int         sc_monitor;
+    unsigned int sc_namelen;
+} StateClient;
+
+void
+state_save(FILE * f)
+{
+    int i, m, n, w;
+    StateHeader h;
+    StateMonitor sm;
+    StateClient sc;
+    Client *c, *t;
+
+    memset(&h, 0, sizeof h);
+    h.s_magic = STATE_MAGIC;
+    h.s_mcount = mcount;
+    h.s_selmonitor = selmonitor;
+    h.s_sel = sel ? sel->c_win : None;
+    for (w = 0; w < 10; w++) {
+        h.s_vsplit[w] = workspaces.w_vSplit[w];
+        h.s_layout[w] = workspaces.w_layout[w] - cfg->cf_layouts;
+    }
+    h.s_nclients = workspaces.w_numClients[0];
+    fwrite(&h, sizeof h, 1, f);
+
+    for (i = 0; i < mcount; i++) {
+        sm.sm_workspace = monitors[i].m_workspace;
+        sm.sm_width = monitors[i].m_width;
+        sm.sm_height = monitors[i].m_height;
+        fwrite(&sm, sizeof sm, 1, f);
+    }
+
+    c = rootClient->c_gnext;
+    for (; c != rootClient; c = c->c_gnext) {
+        memset(&sc, 0, sizeof sc);
+        sc.sc_win = c->c_win;
+        sc.sc_x = c->x;
+        sc.sc_y = c->y;
+        sc.sc_w = c->w;
+        sc.sc_h = c->h;
+        sc.sc_xunits = c->c_xunits;
+        sc.sc_yunits = c->c_yunits;
+        sc.sc_basew = c->c_basew;
+        sc.sc_baseh = c->c_baseh;
+        sc.sc_incw = c->c_incw;
+        sc.sc_inch = c->c_inch;
+        sc.sc_minw = c->c_minw;
+        sc.sc_minh = c->c_minh;
+        sc.sc_maxw = c->c_maxw;
+        sc.sc_maxh = c->c_maxh;
+        sc.sc_minax = c->c_minax;
+        sc.sc_minay = c->c_minay;
+        sc.sc_maxax = c->c_maxax;
+        sc.sc_maxay = c->c_maxay;
+        sc.sc_border = c->c_border;
+        sc.sc_isbanned = c->c_isbanned;
+        sc.sc_isfixed = c->c_isfixed;
+        sc.sc_isfloating = c->c_isfloating;
+        sc.sc_isurgent = c->c_isurgent;
+        sc.sc_monitor = c->c_monitor;
+        sc.sc_namelen = c->c_title->t_len;
+        fwrite(&sc, sizeof sc, 1, f);
+        fwrite(c->c_title->t_str, 1, sc.sc_namelen, f);
+    }
+
+    /*
+     * workspace orders, as client indices into the list above, one
+     * monitor after the other 
+     */
+    for (w = 1; w < 10; w++) {
+        n = workspaces.w_numClients[w];
+        fwrite(&n, sizeof n, 1, f);
+        for (m = 0; m < mcount; m++) {
+            Client *head = monitors[m].m_clients;
+
+            for (t = head->c_next[w]; t != head; t = t->c_next[w]) {
+                i = 0;
+                c = rootClient->c_gnext;
+                for (; c != t; c = c->c_gnext)
+                    i++;
+                fwrite(&i, sizeof i, 1, f);
+            }
+        }
+    }
+}
+
+Bool
+state_load(FILE * f)
+{
+    int i, j, n, w;
+    unsigned int k, nwins = 0, num;
+    StateHeader h;
+    StateMonitor sm;
+    StateClient sc;
+    Client *c, **clients, *focusc = NULL;
+    Window *wins = NULL, *tree, d1, d2;
+    char name[TITLE_MAXLEN + 1];
+    Bool ok = True;
+
+    if (fread(&h, sizeof h, 1, f) != 1 || h.s_magic != STATE_MAGIC
+        || h.s_nclients < 0)
+        return False;
+
+    /*
+     * one XQueryTree per root to drop windows which died during the
+     * restart 
+     */
+    for (i = 0; i < mcount; i++) {
+        for (j = 0; j < i && monitors[j].m_root != monitors[i].m_root; j++);
+        if (j < i || !XQueryTree(dpy, monitors[i].m_root, &d1, &d2, &tree,
+                                 &num))
+            continue;
+        if (num) {
+            wins = realloc(wins, (nwins + num) * sizeof(Window));
+            if (!wins)
+                EXIT("fatal: could not realloc() %u bytes\n",
+                     (unsigned int) ((nwins + num) * sizeof(Window)));
+            memcpy(wins + nwins, tree, num * sizeof(Window));
+            nwins += num;
+        }
+        if (tree)
+            XFree(tree);
+    }
+
+    for (w = 0; w < 10; w++) {
+        workspaces.w_vSplit[w] = h.s_vsplit[w];
+        if (h.s_layout[w] >= 0 && h.s_layout[w] < cfg->cf_nlayouts)
+            workspaces.w_layout[w] = &cfg->cf_layouts[h.s_layout[w]];
+    }
+    for (i = 0; i < h.s_mcount; i++) {
+        if (fread(&sm, sizeof sm, 1, f) != 1)
+            break;
+        if (i >= mcount)
+            continue;
+        monitors[i].m_workspace = sm.sm_workspace;
+        if (sm.sm_width <= monitors[i].m_realWidth
+            && sm.sm_height <= monitors[i].m_realHeight) {
+            monitors[i].m_width = sm.sm_width;
+            monitors[i].m_height = sm.sm_height;
+            updatebarpos(&monitors[i]);
+        }
+    }
+    if (h.s_selmonitor < mcount)
+        selmonitor = h.s_selmonitor;
+
+    clients = emallocz((h.s_nclients ? h.s_nclients : 1) * sizeof(Client *));
+    for (i = 0; i < h.s_nclients; i++) {
+        if (fread(&sc, sizeof sc, 1, f) != 1)
+            break;
+        c = emallocz(sizeof(Client));
+        c->c_win = sc.sc_win;
+        k = sc.sc_namelen < sizeof name ? sc.sc_namelen : sizeof name - 1;
+        if (fread(name, 1, k, f) != k) {
+            free(c);
+            break;
+        }
+        name[k] = '\0';
+        fseek(f, sc.sc_namelen - k, SEEK_CUR);
+        for (k = 0; k < nwins && wins[k] != sc.sc_win; k++);
+        if (k == nwins) {
+            free(c);
+            continue;
+        }
+        title_set(&c->c_title, name);
+        c->x = sc.sc_x;
+        c->y = sc.sc_y;
+        c->w = sc.sc_w;
+        c->h = sc.sc_h;
+        c->c_xunits = sc.sc_xunits;
+        c->c_yunits = sc.sc_yunits;
+        c->c_basew = sc.sc_basew;
+        c->c_baseh = sc.sc_baseh;
+        c->c_incw = sc.sc_incw;
+        c->c_inch = sc.sc_inch;
+        c->c_minw = sc.sc_minw;
+        c->c_minh = sc.sc_minh;
+        c->c_maxw = sc.sc_maxw;
+        c->c_maxh = sc.sc_maxh;
+        c->c_minax = sc.sc_minax;
+        c->c_minay = sc.sc_minay;
+        c->c_maxax = sc.sc_maxax;
+        c->c_maxay = sc.sc_maxay;
+        c->c_border = sc.sc_border;
+        c->c_isbanned = sc.sc_isbanned;
+        c->c_isfixed = sc.sc_isfixed;
+        c->c_isfloating = sc.sc_isfloating;
+        c->c_isurgent = sc.sc_isurgent;
+        c->c_monitor = sc.sc_monitor < mcount ? sc.sc_monitor : 0;
+
+        XSelectInput(dpy, c->c_win,
+                     EnterWindowMask | FocusChangeMask | PropertyChangeMask |
+                     StructureNotifyMask);
+        grabbuttons(c, False);
+        client_attach(c);
+        ws_attach(c, 0);
+        ewmh_addClient(c);
+        clients[i] = c;
+        if (c->c_win == h.s_sel)
+            focusc = c;
+    }
+    free(wins);
+
+    /*
+     * a truncated file has no memberships to read, the clients restored
+     * so far go to the workspace shown on their monitor 
+     */
+    if (i < h.s_nclients) {
+        ok = False;
+        for (j = 0; j < i; j++)
+            if (clients[j])
+                ws_attach(clients[j],
+                          monitors[clients[j]->c_monitor].m_workspace);
+    }
+    for (w = 1; w < 10 && ok; w++) {
+        if (fread(&n, sizeof n, 1, f) != 1)
+            break;
+        while (n-- > 0) {
+            if (fread(&j, sizeof j, 1, f) != 1)
+                break;
+            if (j >= 0 && j < h.s_nclients && clients[j])
+                ws_attach(clients[j], w);
+        }
+    }
+    free(clients);
+
+    arrange();
+    if (focusc)
+        focus(focusc);
+    return ok;
+}
+
+void
+restart(const char *self)
+{
+    FILE *f;
+    char fdstr[16];
+    char *args[4];
+
+    if (!(f = tmpfile())) {
+        fprintf(stderr, "dwm: restart: cannot create state file: %s\n",
+                strerror(errno));
+        return;
+    }
+    state_save(f);
+    fflush(f);
+    rewind(f);
+    snprintf(fdstr, sizeof fdstr, "%d", fileno(f));
+    args[0] = (char *) self;
+    args[1] = "-r";
+    args[2] = fdstr;
+    args[3] = NULL;
+
+    /*
+     * the X connection is closed by the exec itself, so we are still
+     * usable if it fails 
+     */
+    XSync(dpy, False);
+    evtrace_flush();
+    fcntl(ConnectionNumber(dpy), F_SETFD, FD_CLOEXEC);
+    fcntl(fileno(f), F_SETFD, 0);
+    execvp(self, args);
+    fprintf(stderr, "dwm: restart: execvp '%s' failed: %s\n", self,
+            strerror(errno));
+    fclose(f);
+}
+
+/*********************************
+ * Status Functionality
+ *********************************/
+
+#ifdef STATUS
+/*
+ * Built-in status modules replace the status loop on stdin. A timerfd
+ * fires on every full second; each module of statusmods[] is refreshed
+ * once its interval is over. Their files stay open and are re-read with
+ * pread(), and the bar is only redrawn when some module's text changed.
+ */
+int statusfd = -1;
+unsigned long long statusticks = 0;
+
+/*
+ * Reads path, kept open as fd i of s, into buf. Returns the length or -1
+ * if it is unavailable. 
+ */
+int
+status_read(StatusMod * s, int i, const char *path, char *buf,
+            unsigned int size)
+{
+    ssize_t n;
+
+    if (s->sm_fd[i] == -1
+        && (s->sm_fd[i] = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        s->sm_fd[i] = -2;
+    if (s->sm_fd[i] < 0)
+        return -1;
+    if ((n = pread(s->sm_fd[i], buf, size - 1, 0)) < 0)
+        return -1;
+    buf[n] = '\0';
+    return n;
+}
+
+void
+status_clock(StatusMod * s, char *buf, unsigned int size)
+{
+    time_t t = time(NULL);
+
+    if (!strftime(buf, size, s->sm_arg, localtime(&t)))
+        buf[0] = '\0';
+}
+
+void
+status_load(StatusMod * s, char *buf, unsigned int size)
+{
+    char data[64];
+    float l1, l5, l15;
+
+    if (status_read(s, 0, "/proc/loadavg", data, sizeof data) < 0
+        || sscanf(data, "%f %f %f", &l1, &l5, &l15) != 3)
+        return;
+    snprintf(buf, size, "load %.2f %.2f %.2f", l1, l5, l15);
+}
+
+void
+status_mem(StatusMod * s, char *buf, unsigned int size)
+{
+    char data[512], *p;
+    unsigned long total, avail;
+
+    if (status_read(s, 0, "/proc/meminfo", data, sizeof data) < 0
+        || !(p = strstr(data, "MemTotal:"))
+        || sscanf(p, "MemTotal: %lu", &total) != 1 || !total
+        || !(p = strstr(data, "MemAvailable:"))
+        || sscanf(p, "MemAvailable: %lu", &avail) != 1)
+        return;
+    snprintf(buf, size, "mem %lu%%", (total - avail) * 100 / total);
+}
+
+/*
+ * Byte counts with a K, M or G suffix. 
+ */
+void
+status_bytes(char *buf, unsigned int size, unsigned long long n)
+{
+    const char *unit = "KMG";
+    int i = -1;
+
+    while (n >= 1024 && i < 2) {
+        n /= 1024;
+        i++;
+    }
+    if (i < 0)
+        snprintf(buf, size, "%llu", n);
+    else
+        snprintf(buf, size, "%llu%c", n, unit[i]);
+}
+
+void
+status_net(StatusMod * s, char *buf, unsigned int size)
+{
+    const char *dir[2] = { "rx", "tx" };
+    char path[128], data[32], rate[2][16];
+    unsigned long long n, elapsed = statusticks - s->sm_ran;
+    int i;
+
+    /*
+     * ticks coalesced by a busy loop make the real period longer than
+     * sm_interval 
+     */
+    if (!elapsed)
+        elapsed = 1;
+    for (i = 0; i < 2; i++) {
+        snprintf(path, sizeof path, "/sys/class/net/%s/statistics/%s_bytes",
+                 s->sm_arg, dir[i]);
+        if (status_read(s, i, path, data, sizeof data) < 0)
+            return;
+        n = strtoull(data, NULL, 10);
+        status_bytes(rate[i], sizeof rate[i], s->sm_last[i] && n >= s->sm_last[i]
+                     ? (n - s->sm_last[i]) / elapsed : 0);
+        s->sm_last[i] = n;
+    }
+    snprintf(buf, size, "%s %s/%s", s->sm_arg, rate[0], rate[1]);
+}
+
+void
+status_battery(StatusMod * s, char *buf, unsigned int size)
+{
+    char path[128], capacity[16], state[32];
+
+    snprintf(path, sizeof path, "/sys/class/power_supply/%s/capacity",
+             s->sm_arg);
+    if (status_read(s, 0, path, capacity, sizeof capacity) < 0)
+        return;
+    capacity[strcspn(capacity, "\n")] = '\0';
+    snprintf(path, sizeof path, "/sys/class/power_supply/%s/status",
+             s->sm_arg);
+    if (status_read(s, 1, path, state, sizeof state) < 0)
+        state[0] = '\0';
+    snprintf(buf, size, "bat %s%%%s", capacity,
+             !strncmp(state, "Charging", 8) ? "+" : "");
+}
+
+/*
+ * Refreshes the modules which are due and rebuilds stext if any of them
+ * changed. 
+ */
+void
+status_update(void)
+{
+    char text[sizeof ((StatusMod *) 0)->sm_text];
+    unsigned int i, len = 0;
+    Bool changed = False;
+    StatusMod *s;
+
+    for (i = 0; i < LENGTH(statusmods); i++) {
+        s = &statusmods[i];
+        if (statusticks < s->sm_due)
+            continue;
+        s->sm_due = statusticks + (s->sm_interval ? s->sm_interval : 1);
+        text[0] = '\0';
+        s->sm_func(s, text, sizeof text);
+        s->sm_ran = statusticks;
+        if (strcmp(text, s->sm_text)) {
+            strcpy(s->sm_text, text);
+            changed = True;
+        }
+    }
+    if (!changed)
+        return;
+    stext[0] = '\0';
+    for (i = 0; i < LENGTH(statusmods); i++) {
+        if (!statusmods[i].sm_text[0])
+            continue;
+        len += snprintf(stext + len, sizeof stext - len, "%s%s",
+                        len ? " | " : "", statusmods[i].sm_text);
+        if (len >= sizeof stext)
+            break;
+    }
+    drawbar();
+}
+
+/*
+ * Returns False if there are no modules or no timer, dwm then reads the
+ * status from stdin. The timer and module fds are set up only once, a
+ * failed restart comes back here with them still open. 
+ */
+Bool
+status_start(void)
+{
+    struct itimerspec its;
+    unsigned int i;
+
+    if (statusfd != -1)
+        return True;
+    if (!LENGTH(statusmods))
+        return False;
+    if ((statusfd = timerfd_create(CLOCK_REALTIME,
+                                   TFD_NONBLOCK | TFD_CLOEXEC)) == -1)
+        return False;
+    clock_gettime(CLOCK_REALTIME, &its.it_value);
+    its.it_value.tv_sec++;
+    its.it_value.tv_nsec = 0;
+    its.it_interval.tv_sec = 1;
+    its.it_interval.tv_nsec = 0;
+    if (timerfd_settime(statusfd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+        close(statusfd);
+        statusfd = -1;
+        return False;
+    }
+    for (i = 0; i < LENGTH(statusmods); i++)
+        statusmods[i].sm_fd[0] = statusmods[i].sm_fd[1] = -1;
+    status_update();
+    return True;
+}
+
+void
+status_tick(void)
+{
+    uint64_t n;
+
+    if (read(statusfd, &n, sizeof n) != sizeof n)
+        return;
+    statusticks += n;
+    status_update();
+}
+#endif
+
+/*
+ * Event scheduling. Events stay in Xlib's queue until they are handled,
+ * so movemouse(), resizemouse() and the EnterNotify drains still see
+ * them. run() takes them out of order by class: input and focus events
+ * first, then structure events. Property and expose traffic comes last
+ * and gets PROPBUDGET usec per loop, the rest waits for the next one, so
+ * a client flooding PropertyNotify can't delay a KeyPress queued behind
+ * it. Events keep their order within a class.
+ */
+enum { EvInput, EvStructure, EvBackground };
+
+int
+events_class(XEvent * ev)
+{
+    switch (ev->type) {
+    case KeyPress:
+    case KeyRelease:
+    case ButtonPress:
+    case ButtonRelease:
+    case MotionNotify:
+    case EnterNotify:
+    case LeaveNotify:
+    case FocusIn:
+    case FocusOut:
+    case MappingNotify:
+        return EvInput;
+    case MapRequest:
+    case ConfigureRequest:
+    case ConfigureNotify:
+    case UnmapNotify:
+    case DestroyNotify:
+    case ClientMessage:
+        return EvStructure;
+    }
+#ifdef XRANDR
+    if (rrevbase != -1 && ev->type == rrevbase + RRScreenChangeNotify)
+        return EvStructure;
+#endif
+    return EvBackground;
+}
+
+Bool
+events_isClass(Display * d, XEvent * ev, XPointer arg)
+{
+    return events_class(ev) == *(int *) arg;
+}
+
+/*
+ * Takes the first queued event of class out of Xlib's queue. 
+ */
+Bool
+events_take(int class, XEvent * ev)
+{
+    return XCheckIfEvent(dpy, ev, events_isClass, (XPointer) & class);
+}
+
+void
+events_dispatch(XEvent * ev)
+{
+    TraceRecord tr;
+
+    evtrace_begin(&tr, ev, TRACE_RUN);
+#ifdef XRANDR
+    if (rrevbase != -1 && ev->type == rrevbase + RRScreenChangeNotify) {
+        XRRUpdateConfiguration(ev);
+        if (updategeom())
+            arrange();
+        evtrace_end(&tr);
+        return;
+    }
+#endif
+    if (handler[ev->type])
+        (handler[ev->type]) (ev);       /* call handler */
+    evtrace_end(&tr);
+}
+
+/*
+ * Handles what is queued, returns True if events were left for the next
+ * loop. A search for input and structure events which found none isn't
+ * repeated before the queue changed, so a long property backlog isn't
+ * scanned once per event. 
+ */
+Bool
+events_run(void)
+{
+    XEvent ev;
+    struct timespec start, now;
+    Bool started = False;
+    int seen = -1;
+
+    for (;;) {
+        XEventsQueued(dpy, QueuedAfterReading);
+        if (XQLength(dpy) != seen) {
+            if (events_take(EvInput, &ev) || events_take(EvStructure, &ev)) {
+                events_dispatch(&ev);
+                seen = -1;
+                continue;
+            }
+            seen = XQLength(dpy);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (!started) {
+            start = now;
+            started = True;
+        } else if ((now.tv_sec - start.tv_sec) * 1000000
+                   + (now.tv_nsec - start.tv_nsec) / 1000 >= PROPBUDGET)
+            return XQLength(dpy) > 0;
+        if (!events_take(EvBackground, &ev))
+            return XQLength(dpy) > 0;
+        seen--;
+        events_dispatch(&ev);
+    }
+}
+
 void
 run(void)
 {
     char *p;
     char buf[sizeof stext];
     fd_set rd;
-    int r, xfd;
+    int r, xfd, maxfd, due;
     unsigned int len, offset;
-    XEvent ev;
+    struct timeval tv;
+    Bool backlog = False;
 
     /*
      * main event loop, also reads status text from stdin 
      */
     XSync(dpy, False);
     xfd = ConnectionNumber(dpy);
+#ifdef STATUS
+    readin = !status_start();
+#else
     readin = True;
+#endif
     offset = 0;
     len = sizeof stext - 1;
     buf[len] = stext[len] = '\0';       /* 0-terminator is never touched */
     while (running) {
+        due = adjust_flush();
+        ewmh_flush();
+        evtrace_flush();
         FD_ZERO(&rd);
         if (readin)
             FD_SET(STDIN_FILENO, &rd);
         FD_SET(xfd, &rd);
-        if (select(xfd + 1, &rd, NULL, NULL, NULL) == -1) {
+        maxfd = xfd;
+        if (configwatchfd != -1) {
+            FD_SET(configwatchfd, &rd);
+            if (configwatchfd > maxfd)
+                maxfd = configwatchfd;
+        }
+#ifdef STATUS
+        if (statusfd != -1) {
+            FD_SET(statusfd, &rd);
+            if (statusfd > maxfd)
+                maxfd = statusfd;
+        }
+#endif
+#ifdef PROPTHREAD
+        FD_SET(propresultfd, &rd);
+        if (propresultfd > maxfd)
+            maxfd = propresultfd;
+#endif
+        if (backlog)
+            due = 0;
+        tv.tv_sec = 0;
+        tv.tv_usec = due * 1000;
+        if (select(maxfd + 1, &rd, NULL, NULL, due < 0 ? NULL : &tv) == -1) {
             if (errno == EINTR)
                 continue;
             EXIT("select failed\n");
         }
+        if (configwatchfd != -1 && FD_ISSET(configwatchfd, &rd))
+            config_watchEvent();
+#ifdef STATUS
+        if (statusfd != -1 && FD_ISSET(statusfd, &rd))
+            status_tick();
+#endif
+#ifdef PROPTHREAD
+        if (FD_ISSET(propresultfd, &rd))
+            prop_drain();
+#endif
         if (FD_ISSET(STDIN_FILENO, &rd)) {
             switch ((r = read(STDIN_FILENO, buf + offset, len - offset))) {
             case -1:
@@ -2285,11 +5788,7 @@ run(void)
             }
             drawbar();
         }
-        while (XPending(dpy)) {
-            XNextEvent(dpy, &ev);
-            if (handler[ev.type])
-                (handler[ev.type]) (&ev);       /* call handler */
-        }
+        backlog = events_run();
     }
 }
 
@@ -2297,41 +5796,66 @@ void
 cleanup(void)
 {
     unsigned int i;
+    Client *c;
+
     close(STDIN_FILENO);
     while (stack) {
         unban(stack);
         unmanage(stack);
     }
+    /*
+     * don't leave unmapped clients behind 
+     */
+    c = rootClient->c_gnext;
+    for (; c != rootClient; c = c->c_gnext)
+        unban(c);
+    ewmh_cleanup();
+#ifdef BARTHREAD
+    bar_stop();
+#endif
+#ifdef PROPTHREAD
+    prop_stop();
+#endif
     for (i = 0; i < mcount; i++) {
         Monitor *m = &monitors[i];
-        if (m->dc.font.set)
-            XFreeFontSet(dpy, m->dc.font.set);
-        else
-            XFreeFont(dpy, m->dc.font.xfont);
         XUngrabKey(dpy, AnyKey, AnyModifier, m->m_root);
-        XFreePixmap(dpy, m->dc.drawable);
-        XFreeGC(dpy, m->dc.gc);
-        XDestroyWindow(dpy, m->m_barwin);
+        monitor_freeBar(m);
         XFreeCursor(dpy, cursor[CurNormal]);
         XFreeCursor(dpy, cursor[CurResize]);
         XFreeCursor(dpy, cursor[CurMove]);
         XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
         XSync(dpy, False);
     }
+#ifdef BARTHREAD
+    XCloseDisplay(bdpy);
+#endif
 }
 
 int
 main(int argc, char *argv[])
 {
-    if (argc == 2 && !strcmp("-v", argv[1])) {
-        EXIT("dwm-" VERSION
-             ", © 2006-2007 Anselm R. Garbe, Sander van Dijk, "
-             "Jukka Salmi, Premysl Hruby, Szabolcs Nagy, Christof Musik\n");
-    } else if (argc != 1) {
-        EXIT("usage: dwm [-v]\n");
+    FILE *f;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp("-v", argv[i])) {
+            EXIT("dwm-" VERSION
+                 ", © 2006-2007 Anselm R. Garbe, Sander van Dijk, "
+                 "Jukka Salmi, Premysl Hruby, Szabolcs Nagy, Christof Musik\n");
+        } else if (!strcmp("-r", argv[i]) && i + 1 < argc) {
+            restorefd = atoi(argv[++i]);
+        } else if (!strcmp("-t", argv[i]) && i + 1 < argc) {
+            evtrace_open(argv[++i]);
+        } else {
+            EXIT("usage: dwm [-v] [-t tracefile]\n");
+        }
     }
 
     setlocale(LC_CTYPE, "");
+#if defined(BARTHREAD) || defined(PROPTHREAD)
+    if (!XInitThreads())
+        EXIT("dwm: no thread support in Xlib\n");
+#endif
     if (!(dpy = XOpenDisplay(0))) {
         EXIT("dwm: cannot open display\n");
     }
@@ -2339,9 +5863,31 @@ main(int argc, char *argv[])
     checkotherwm();
     setup();
     drawbar();
+    if (restorefd != -1) {
+        if (!(f = fdopen(restorefd, "rb")) || !state_load(f))
+            fprintf(stderr, "dwm: cannot restore state, scanning\n");
+        if (f)
+            fclose(f);
+    }
+    /*
+     * after a restore this picks up the windows mapped while no window
+     * manager was running, and the rest of a truncated state file 
+     */
     scan();
-    run();
+    for (;;) {
+        run();
+        if (!restarting)
+            break;
+        restart(argv[0]);
+        /*
+         * still here, the exec failed 
+         */
+        restarting = False;
+        running = True;
+    }
     cleanup();
+    if (evtrace)
+        fclose(evtrace);
 
     XCloseDisplay(dpy);
     return 0;
@@ -0,0 +1,571 @@
+/*
+ * See LICENSE file for copyright and license details. dwmreplay reads an
+ * event trace recorded by dwm -t and reproduces it against a fresh dwm,
+ * normally running on an Xvfb server. Windows seen in the trace are stood
+ * in for by synthetic clients, which are mapped, configured, retitled and
+ * destroyed when the recording says so; input is injected through XTEST.
+ * The replayed dwm records its own trace, and both traces are summarized
+ * per event type: count, latency and X requests per event.
+ */
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XTest.h>
+#include "trace.h"
+
+typedef struct {
+    TraceRecord *recs;
+    unsigned int nrecs;
+    char      **names;          /* atom names, parallel to recs */
+} Trace;
+
+typedef struct Stand Stand;
+struct Stand {
+    Stand      *s_next;
+    uint32_t    s_traced;       /* window id in the recording */
+    Window      s_win;          /* our stand in, None until mapped */
+    int         s_x, s_y;
+    unsigned int s_w, s_h;
+    unsigned int s_titles;
+    Bool        s_urgent;
+};
+
+Display *dpy;
+Window root;
+Stand *stands = NULL;
+KeyCode modcodes[8];            /* a keycode for each modifier bit */
+
+const char *evnames[LASTEvent] = {
+    [KeyPress] = "KeyPress",
+    [KeyRelease] = "KeyRelease",
+    [ButtonPress] = "ButtonPress",
+    [ButtonRelease] = "ButtonRelease",
+    [MotionNotify] = "MotionNotify",
+    [EnterNotify] = "EnterNotify",
+    [LeaveNotify] = "LeaveNotify",
+    [FocusIn] = "FocusIn",
+    [FocusOut] = "FocusOut",
+    [Expose] = "Expose",
+    [DestroyNotify] = "DestroyNotify",
+    [UnmapNotify] = "UnmapNotify",
+    [MapNotify] = "MapNotify",
+    [MapRequest] = "MapRequest",
+    [ConfigureNotify] = "ConfigureNotify",
+    [ConfigureRequest] = "ConfigureRequest",
+    [PropertyNotify] = "PropertyNotify",
+    [ClientMessage] = "ClientMessage",
+    [MappingNotify] = "MappingNotify",
+};
+
+void
+die(const char *errstr, ...)
+{
+    va_list ap;
+
+    va_start(ap, errstr);
+    vfprintf(stderr, errstr, ap);
+    va_end(ap);
+    exit(EXIT_FAILURE);
+}
+
+void *
+emallocz(size_t size)
+{
+    void *res = calloc(1, size);
+
+    if (!res)
+        die("dwmreplay: could not malloc() %lu bytes\n",
+            (unsigned long) size);
+    return res;
+}
+
+const char *
+evname(unsigned int type)
+{
+    static char buf[16];
+
+    if (type < LASTEvent && evnames[type])
+        return evnames[type];
+    snprintf(buf, sizeof buf, "event %u", type);
+    return buf;
+}
+
+/*
+ * Reads a whole trace; atom name records are folded into the names of
+ * the records mentioning the atom.
+ */
+Trace *
+trace_load(const char *path)
+{
+    FILE *f;
+    TraceHeader h;
+    TraceRecord r;
+    Trace *t;
+    unsigned int size = 0, i;
+    uint32_t *atoms = NULL;
+    char **atomnames = NULL;
+    unsigned int natoms = 0;
+    char *name;
+
+    if (!(f = fopen(path, "rb")))
+        die("dwmreplay: cannot open %s: %s\n", path, strerror(errno));
+    if (fread(&h, sizeof h, 1, f) != 1 || h.h_magic != TRACE_MAGIC
+        || h.h_version != TRACE_VERSION || h.h_recsize != sizeof r)
+        die("dwmreplay: %s is not a dwm trace\n", path);
+    t = emallocz(sizeof(Trace));
+    while (fread(&r, sizeof r, 1, f) == 1) {
+        if (r.t_type == TRACE_ATOMNAME) {
+            name = emallocz(r.t_w + 1);
+            if (fread(name, 1, r.t_w, f) != r.t_w)
+                break;
+            atoms = realloc(atoms, (natoms + 1) * sizeof(uint32_t));
+            atomnames = realloc(atomnames, (natoms + 1) * sizeof(char *));
+            if (!atoms || !atomnames)
+                die("dwmreplay: out of memory\n");
+            atoms[natoms] = r.t_extra;
+            atomnames[natoms++] = name;
+            continue;
+        }
+        if (t->nrecs == size) {
+            size = size ? size * 2 : 1024;
+            t->recs = realloc(t->recs, size * sizeof(TraceRecord));
+            t->names = realloc(t->names, size * sizeof(char *));
+            if (!t->recs || !t->names)
+                die("dwmreplay: out of memory\n");
+        }
+        t->names[t->nrecs] = NULL;
+        if (r.t_type == PropertyNotify || r.t_type == ClientMessage) {
+            for (i = 0; i < natoms && atoms[i] != r.t_extra; i++);
+            if (i < natoms)
+                t->names[t->nrecs] = atomnames[i];
+            else if (dpy && r.t_extra <= XA_LAST_PREDEFINED)
+                t->names[t->nrecs] = XGetAtomName(dpy, r.t_extra);
+        }
+        t->recs[t->nrecs++] = r;
+    }
+    fclose(f);
+    free(atoms);
+    free(atomnames);
+    return t;
+}
+
+int
+cmplatency(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+void
+trace_summary(const char *title, Trace * t)
+{
+    unsigned int type, i, n;
+    uint64_t sum, reqs;
+    uint32_t *lat;
+
+    printf("%s: %u events\n", title, t->nrecs);
+    printf("  %-18s %8s %10s %10s %10s %10s\n", "event", "count",
+           "mean us", "p99 us", "max us", "reqs/ev");
+    lat = emallocz((t->nrecs + 1) * sizeof(uint32_t));
+    for (type = 0; type < 256; type++) {
+        sum = reqs = 0;
+        for (i = n = 0; i < t->nrecs; i++) {
+            if (t->recs[i].t_type != type)
+                continue;
+            lat[n++] = t->recs[i].t_latency;
+            sum += t->recs[i].t_latency;
+            reqs += t->recs[i].t_requests;
+        }
+        if (!n)
+            continue;
+        qsort(lat, n, sizeof(uint32_t), cmplatency);
+        printf("  %-18s %8u %10.1f %10u %10u %10.2f\n", evname(type), n,
+               (double) sum / n, lat[(n - 1) * 99 / 100], lat[n - 1],
+               (double) reqs / n);
+    }
+    free(lat);
+}
+
+void
+trace_print(Trace * t)
+{
+    unsigned int i;
+    TraceRecord *r;
+
+    for (i = 0; i < t->nrecs; i++) {
+        r = &t->recs[i];
+        printf("%10llu %6u us %4u req %-16s %c win 0x%08x subj 0x%08x "
+               "extra %u state 0x%x %d,%d %ux%u%s%s\n",
+               (unsigned long long) r->t_usec, r->t_latency, r->t_requests,
+               evname(r->t_type), "rmz"[r->t_origin % 3], r->t_window,
+               r->t_subject, r->t_extra, r->t_state, r->t_x, r->t_y,
+               r->t_w, r->t_h, t->names[i] ? " " : "",
+               t->names[i] ? t->names[i] : "");
+    }
+}
+
+/*
+ * The outer event of a drag is written after the events handled inside
+ * it, replay in the order the events arrived.
+ */
+int
+cmpusec(const void *a, const void *b)
+{
+    const TraceRecord *x = *(TraceRecord * const *) a;
+    const TraceRecord *y = *(TraceRecord * const *) b;
+
+    if (x->t_usec != y->t_usec)
+        return x->t_usec < y->t_usec ? -1 : 1;
+    return x < y ? -1 : x > y;
+}
+
+Stand *
+stand_get(uint32_t traced, Bool create)
+{
+    Stand *s;
+
+    for (s = stands; s; s = s->s_next)
+        if (s->s_traced == traced)
+            return s;
+    if (!create)
+        return NULL;
+    s = emallocz(sizeof(Stand));
+    s->s_traced = traced;
+    s->s_w = 400;
+    s->s_h = 300;
+    s->s_next = stands;
+    stands = s;
+    return s;
+}
+
+void
+stand_title(Stand * s)
+{
+    char buf[64];
+    XTextProperty prop;
+    char *list = buf;
+
+    snprintf(buf, sizeof buf, "replay 0x%x #%u", s->s_traced, s->s_titles++);
+    if (XStringListToTextProperty(&list, 1, &prop)) {
+        XSetWMName(dpy, s->s_win, &prop);
+        XFree(prop.value);
+    }
+}
+
+void
+stand_map(Stand * s)
+{
+    Atom wmdelete;
+
+    if (!s->s_win) {
+        s->s_win = XCreateSimpleWindow(dpy, root, s->s_x, s->s_y, s->s_w,
+                                       s->s_h, 0, 0,
+                                       WhitePixel(dpy, DefaultScreen(dpy)));
+        wmdelete = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
+        XSetWMProtocols(dpy, s->s_win, &wmdelete, 1);
+        stand_title(s);
+    }
+    XMapWindow(dpy, s->s_win);
+}
+
+void
+stand_destroy(Stand * s)
+{
+    Stand **p;
+
+    if (s->s_win)
+        XDestroyWindow(dpy, s->s_win);
+    for (p = &stands; *p != s; p = &(*p)->s_next);
+    *p = s->s_next;
+    free(s);
+}
+
+void
+stand_property(Stand * s, const char *name)
+{
+    XWMHints *wmh;
+    XSizeHints size;
+
+    if (!s->s_win || !name)
+        return;
+    if (!strcmp(name, "WM_NAME") || !strcmp(name, "_NET_WM_NAME")) {
+        stand_title(s);
+    } else if (!strcmp(name, "WM_HINTS")) {
+        if (!(wmh = XGetWMHints(dpy, s->s_win)))
+            wmh = XAllocWMHints();
+        s->s_urgent = !s->s_urgent;
+        if (s->s_urgent)
+            wmh->flags |= XUrgencyHint;
+        else
+            wmh->flags &= ~XUrgencyHint;
+        XSetWMHints(dpy, s->s_win, wmh);
+        XFree(wmh);
+    } else if (!strcmp(name, "WM_NORMAL_HINTS")) {
+        memset(&size, 0, sizeof size);
+        size.flags = PMinSize | PResizeInc;
+        size.min_width = size.min_height = 32;
+        size.width_inc = size.height_inc = 1 + s->s_titles % 8;
+        XSetWMNormalHints(dpy, s->s_win, &size);
+    }
+}
+
+void
+initmodcodes(void)
+{
+    XModifierKeymap *modmap;
+    int i, j;
+
+    modmap = XGetModifierMapping(dpy);
+    for (i = 0; i < 8; i++)
+        for (j = modmap->max_keypermod - 1; j >= 0; j--)
+            if (modmap->modifiermap[i * modmap->max_keypermod + j])
+                modcodes[i] = modmap->modifiermap[i * modmap->max_keypermod + j];
+    XFreeModifiermap(modmap);
+}
+
+void
+fakemods(unsigned int state, Bool press)
+{
+    int i;
+
+    for (i = 0; i < 8; i++)
+        if (i != 1 && (state & (1 << i)) && modcodes[i])   /* not Lock */
+            XTestFakeKeyEvent(dpy, modcodes[i], press, CurrentTime);
+}
+
+void
+replay_record(TraceRecord * r, const char *name)
+{
+    Stand *s;
+    XWindowChanges wc;
+    KeyCode code;
+
+    switch (r->t_type) {
+    case MapRequest:
+        stand_map(stand_get(r->t_subject, True));
+        break;
+    case UnmapNotify:
+        /*
+         * only withdrawals, the replayed dwm bans the stand-in itself
+         */
+        if (r->t_window == r->t_subject && !r->t_state
+            && (s = stand_get(r->t_subject, False)) && s->s_win)
+            XUnmapWindow(dpy, s->s_win);
+        break;
+    case DestroyNotify:
+        if ((s = stand_get(r->t_subject, False)))
+            stand_destroy(s);
+        break;
+    case ConfigureRequest:
+        s = stand_get(r->t_subject, True);
+        if (r->t_extra & CWX)
+            s->s_x = wc.x = r->t_x;
+        if (r->t_extra & CWY)
+            s->s_y = wc.y = r->t_y;
+        if (r->t_extra & CWWidth)
+            s->s_w = wc.width = r->t_w ? r->t_w : 1;
+        if (r->t_extra & CWHeight)
+            s->s_h = wc.height = r->t_h ? r->t_h : 1;
+        wc.border_width = r->t_state;
+        if (s->s_win)
+            XConfigureWindow(dpy, s->s_win, r->t_extra & (CWX | CWY | CWWidth
+                                                          | CWHeight |
+                                                          CWBorderWidth), &wc);
+        break;
+    case PropertyNotify:
+        if (r->t_state == PropertyNewValue
+            && (s = stand_get(r->t_window, False)))
+            stand_property(s, name);
+        break;
+    case KeyPress:
+        if (!(code = XKeysymToKeycode(dpy, r->t_keysym)))
+            break;
+        fakemods(r->t_state, True);
+        XTestFakeKeyEvent(dpy, code, True, CurrentTime);
+        XTestFakeKeyEvent(dpy, code, False, CurrentTime);
+        fakemods(r->t_state, False);
+        break;
+    case ButtonPress:
+        XTestFakeMotionEvent(dpy, -1, r->t_x, r->t_y, CurrentTime);
+        fakemods(r->t_state, True);
+        XTestFakeButtonEvent(dpy, r->t_extra, True, CurrentTime);
+        fakemods(r->t_state, False);
+        break;
+    case ButtonRelease:
+        XTestFakeMotionEvent(dpy, -1, r->t_x, r->t_y, CurrentTime);
+        XTestFakeButtonEvent(dpy, r->t_extra, False, CurrentTime);
+        break;
+    case MotionNotify:
+    case EnterNotify:
+        XTestFakeMotionEvent(dpy, -1, r->t_x, r->t_y, CurrentTime);
+        break;
+    default:
+        /*
+         * consequences of the above, the server generates them again
+         */
+        break;
+    }
+}
+
+void
+sleepuntil(struct timespec *start, uint64_t usec)
+{
+    struct timespec now, ts;
+    int64_t left;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    left = (int64_t) usec - ((int64_t) (now.tv_sec - start->tv_sec) * 1000000
+                             + (now.tv_nsec - start->tv_nsec) / 1000);
+    if (left <= 0)
+        return;
+    ts.tv_sec = left / 1000000;
+    ts.tv_nsec = (left % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+Bool
+wmrunning(void)
+{
+    Atom type, check = XInternAtom(dpy, "_NET_SUPPORTING_WM_CHECK", False);
+    int format;
+    unsigned long n, extra;
+    unsigned char *p = NULL;
+    Bool ret;
+
+    if (XGetWindowProperty(dpy, root, check, 0, 1, False, XA_WINDOW, &type,
+                           &format, &n, &extra, &p) != Success)
+        return False;
+    ret = n == 1;
+    XFree(p);
+    return ret;
+}
+
+pid_t
+startwm(const char *wm, const char *tracepath)
+{
+    struct timespec ts = { 0, 20 * 1000 * 1000 };
+    pid_t pid;
+    int i, fd;
+
+    XDeleteProperty(dpy, root,
+                    XInternAtom(dpy, "_NET_SUPPORTING_WM_CHECK", False));
+    XSync(dpy, False);
+    if ((pid = fork()) == -1)
+        die("dwmreplay: fork failed: %s\n", strerror(errno));
+    if (pid == 0) {
+        close(ConnectionNumber(dpy));
+        if ((fd = open("/dev/null", O_RDONLY)) != -1)
+            dup2(fd, STDIN_FILENO);
+        execlp(wm, wm, "-t", tracepath, (char *) NULL);
+        fprintf(stderr, "dwmreplay: execlp '%s' failed: %s\n", wm,
+                strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < 250 && !wmrunning(); i++)
+        nanosleep(&ts, NULL);
+    if (i == 250)
+        die("dwmreplay: %s did not start\n", wm);
+    return pid;
+}
+
+void
+usage(void)
+{
+    die("usage: dwmreplay [-f] [-p] [-v] [-w dwm] trace\n"
+        "  -f  replay as fast as possible instead of at recorded pace\n"
+        "  -p  print and summarize the trace, don't replay it\n"
+        "  -v  also print every event of the replayed trace\n"
+        "  -w  window manager to run, default dwm\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    Bool fast = False, printonly = False, verbose = False;
+    const char *wm = "dwm", *path = NULL;
+    char outpath[] = "/tmp/dwmreplay.XXXXXX";
+    struct timespec start, ts = { 0, 500 * 1000 * 1000 };
+    Trace *t, *out;
+    TraceRecord **order;
+    unsigned int i;
+    int fd, status, ev, err, major, minor;
+    pid_t pid;
+
+    for (i = 1; i < (unsigned int) argc; i++) {
+        if (!strcmp(argv[i], "-f"))
+            fast = True;
+        else if (!strcmp(argv[i], "-p"))
+            printonly = True;
+        else if (!strcmp(argv[i], "-v"))
+            verbose = True;
+        else if (!strcmp(argv[i], "-w") && i + 1 < (unsigned int) argc)
+            wm = argv[++i];
+        else if (!path && argv[i][0] != '-')
+            path = argv[i];
+        else
+            usage();
+    }
+    if (!path)
+        usage();
+
+    if (printonly) {
+        t = trace_load(path);
+        trace_print(t);
+        trace_summary("recorded", t);
+        return 0;
+    }
+    if (!(dpy = XOpenDisplay(NULL)))
+        die("dwmreplay: cannot open display\n");
+    root = DefaultRootWindow(dpy);
+    t = trace_load(path);
+    if (!XTestQueryExtension(dpy, &ev, &err, &major, &minor))
+        die("dwmreplay: the server lacks the XTEST extension\n");
+    initmodcodes();
+
+    if ((fd = mkstemp(outpath)) == -1)
+        die("dwmreplay: cannot create %s: %s\n", outpath, strerror(errno));
+    close(fd);
+    pid = startwm(wm, outpath);
+
+    order = emallocz((t->nrecs + 1) * sizeof(TraceRecord *));
+    for (i = 0; i < t->nrecs; i++)
+        order[i] = &t->recs[i];
+    qsort(order, t->nrecs, sizeof(TraceRecord *), cmpusec);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < t->nrecs; i++) {
+        if (!fast)
+            sleepuntil(&start, order[i]->t_usec - order[0]->t_usec);
+        replay_record(order[i], t->names[order[i] - t->recs]);
+        XFlush(dpy);
+    }
+
+    /*
+     * let dwm catch up, it flushes its trace whenever it goes idle
+     */
+    XSync(dpy, False);
+    nanosleep(&ts, NULL);
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+
+    out = trace_load(outpath);
+    unlink(outpath);
+    if (verbose)
+        trace_print(out);
+    trace_summary("recorded", t);
+    trace_summary("replayed", out);
+    XCloseDisplay(dpy);
+    return 0;
+}
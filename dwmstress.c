@@ -0,0 +1,325 @@
+/*
+ * See LICENSE file for copyright and license details. dwmstress opens
+ * windows in bursts against a running dwm, normally on an Xvfb server,
+ * to measure how fast manage(), unmanage() and propertynotify() keep up.
+ * Windows get randomized size hints, transient hints, urgency and
+ * protocols; titles of live windows are churned at a fixed rate. For
+ * every window the time from XMapWindow() until dwm has configured and
+ * mapped it (its MapNotify) is measured, and the run ends with windows
+ * per second and the latency distribution.
+ */
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+typedef struct {
+    Window      w_win;
+    uint64_t    w_mapped;       /* usec of XMapWindow(), 0 once seen */
+    Bool        w_configured;
+    unsigned int w_titles;
+} Win;
+
+Display *dpy;
+Window root;
+Atom wmdelete, wmtakefocus, netwmname, utf8string;
+Win *wins;                      /* ring of live windows, oldest first */
+unsigned int head = 0, nlive = 0, maxlive = 200;
+unsigned int total = 1000, burst = 50, churnrate = 100;
+unsigned int urgentpct = 5, transientpct = 10;
+uint64_t *latencies;
+unsigned int nlatencies = 0, ntimeouts = 0, nconfigured = 0;
+uint64_t nrenames = 0;
+
+void
+die(const char *errstr, ...)
+{
+    va_list ap;
+
+    va_start(ap, errstr);
+    vfprintf(stderr, errstr, ap);
+    va_end(ap);
+    exit(EXIT_FAILURE);
+}
+
+uint64_t
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+Win *
+live(unsigned int i)
+{
+    return &wins[(head + i) % maxlive];
+}
+
+Win *
+findwin(Window w)
+{
+    unsigned int i;
+
+    for (i = 0; i < nlive; i++)
+        if (live(i)->w_win == w)
+            return live(i);
+    return NULL;
+}
+
+void
+settitle(Win * w)
+{
+    char buf[64];
+
+    snprintf(buf, sizeof buf, "dwmstress 0x%lx title %u",
+             (unsigned long) w->w_win, w->w_titles++);
+    XStoreName(dpy, w->w_win, buf);
+    XChangeProperty(dpy, w->w_win, netwmname, utf8string, 8,
+                    PropModeReplace, (unsigned char *) buf, strlen(buf));
+}
+
+void
+sethints(Win * w)
+{
+    XSizeHints size;
+    XWMHints wmh;
+    Atom protos[2];
+    int n = 0;
+
+    memset(&size, 0, sizeof size);
+    if (rand() % 2) {
+        size.flags |= PMinSize;
+        size.min_width = 16 + rand() % 200;
+        size.min_height = 16 + rand() % 200;
+    }
+    if (rand() % 4 == 0) {
+        size.flags |= PMaxSize;
+        size.max_width = size.min_width + rand() % 800;
+        size.max_height = size.min_height + rand() % 600;
+    }
+    if (rand() % 3 == 0) {
+        size.flags |= PResizeInc | PBaseSize;
+        size.width_inc = 1 + rand() % 12;
+        size.height_inc = 1 + rand() % 20;
+        size.base_width = rand() % 20;
+        size.base_height = rand() % 20;
+    }
+    if (rand() % 8 == 0) {
+        size.flags |= PAspect;
+        size.min_aspect.x = 1 + rand() % 4;
+        size.min_aspect.y = 1 + rand() % 4;
+        size.max_aspect.x = size.min_aspect.x + rand() % 4;
+        size.max_aspect.y = size.min_aspect.y;
+    }
+    XSetWMNormalHints(dpy, w->w_win, &size);
+
+    memset(&wmh, 0, sizeof wmh);
+    wmh.flags = InputHint;
+    wmh.input = rand() % 4 != 0;
+    if ((unsigned int) (rand() % 100) < urgentpct)
+        wmh.flags |= XUrgencyHint;
+    XSetWMHints(dpy, w->w_win, &wmh);
+
+    if (rand() % 2)
+        protos[n++] = wmdelete;
+    if (rand() % 2)
+        protos[n++] = wmtakefocus;
+    if (n)
+        XSetWMProtocols(dpy, w->w_win, protos, n);
+
+    if (nlive > 1 && (unsigned int) (rand() % 100) < transientpct)
+        XSetTransientForHint(dpy, w->w_win,
+                             live(rand() % (nlive - 1))->w_win);
+}
+
+void
+destroyoldest(unsigned int n)
+{
+    Win *w;
+
+    while (n-- && nlive) {
+        w = live(0);
+        XUnmapWindow(dpy, w->w_win);
+        XDestroyWindow(dpy, w->w_win);
+        head = (head + 1) % maxlive;
+        nlive--;
+    }
+}
+
+void
+handleevents(unsigned int *pending)
+{
+    XEvent ev;
+    Win *w;
+
+    while (XPending(dpy)) {
+        XNextEvent(dpy, &ev);
+        if (!(w = findwin(ev.xany.window)))
+            continue;
+        if (ev.type == ConfigureNotify && !w->w_configured) {
+            w->w_configured = True;
+            nconfigured++;
+        } else if (ev.type == MapNotify && w->w_mapped) {
+            latencies[nlatencies++] = now() - w->w_mapped;
+            w->w_mapped = 0;
+            (*pending)--;
+        }
+    }
+}
+
+/*
+ * Renames random live windows at churnrate per second until the burst
+ * is mapped or timeout usec have passed.
+ */
+void
+churn(unsigned int *pending, uint64_t timeout)
+{
+    uint64_t start = now(), next = start, t;
+    struct timeval tv;
+    fd_set rd;
+    Win *w;
+
+    while (*pending && (t = now()) - start < timeout) {
+        if (churnrate && nlive && t >= next) {
+            w = live(rand() % nlive);
+            if (!w->w_mapped) {
+                settitle(w);
+                nrenames++;
+            }
+            next += 1000000 / churnrate;
+            XFlush(dpy);
+        }
+        handleevents(pending);
+        if (!*pending)
+            break;
+        FD_ZERO(&rd);
+        FD_SET(ConnectionNumber(dpy), &rd);
+        t = now();
+        tv.tv_sec = 0;
+        tv.tv_usec = churnrate ? (next > t ? next - t : 0) : 10000;
+        if (tv.tv_usec > 10000)
+            tv.tv_usec = 10000;
+        select(ConnectionNumber(dpy) + 1, &rd, NULL, NULL, &tv);
+    }
+}
+
+int
+cmpu64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+void
+usage(void)
+{
+    die("usage: dwmstress [-n total] [-b burst] [-l live] [-c renames/s]\n"
+        "                 [-u urgent%%] [-t transient%%] [-s seed]\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned int created = 0, pending, i, n, seed = time(NULL);
+    uint64_t start, busy = 0, t;
+    XSetWindowAttributes wa;
+    Win *w;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:b:l:c:u:t:s:")) != -1) {
+        switch (c) {
+        case 'n': total = atoi(optarg); break;
+        case 'b': burst = atoi(optarg); break;
+        case 'l': maxlive = atoi(optarg); break;
+        case 'c': churnrate = atoi(optarg); break;
+        case 'u': urgentpct = atoi(optarg); break;
+        case 't': transientpct = atoi(optarg); break;
+        case 's': seed = atoi(optarg); break;
+        default: usage();
+        }
+    }
+    if (!burst || maxlive < burst)
+        usage();
+    srand(seed);
+
+    if (!(dpy = XOpenDisplay(NULL)))
+        die("dwmstress: cannot open display\n");
+    root = DefaultRootWindow(dpy);
+    wmdelete = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
+    wmtakefocus = XInternAtom(dpy, "WM_TAKE_FOCUS", False);
+    netwmname = XInternAtom(dpy, "_NET_WM_NAME", False);
+    utf8string = XInternAtom(dpy, "UTF8_STRING", False);
+    wins = calloc(maxlive, sizeof(Win));
+    latencies = calloc(total + 1, sizeof(uint64_t));
+    if (!wins || !latencies)
+        die("dwmstress: out of memory\n");
+
+    wa.event_mask = StructureNotifyMask;
+    wa.background_pixel = WhitePixel(dpy, DefaultScreen(dpy));
+    start = now();
+    while (created < total) {
+        n = total - created < burst ? total - created : burst;
+        if (nlive + n > maxlive)
+            destroyoldest(nlive + n - maxlive);
+        t = now();
+        for (i = 0; i < n; i++) {
+            w = live(nlive++);
+            memset(w, 0, sizeof(Win));
+            w->w_win = XCreateWindow(dpy, root, rand() % 800, rand() % 600,
+                                     50 + rand() % 600, 50 + rand() % 400,
+                                     0, CopyFromParent, InputOutput,
+                                     CopyFromParent,
+                                     CWEventMask | CWBackPixel, &wa);
+            sethints(w);
+            settitle(w);
+        }
+        XSync(dpy, False);
+        for (i = nlive - n; i < nlive; i++) {
+            live(i)->w_mapped = now();
+            XMapWindow(dpy, live(i)->w_win);
+        }
+        XFlush(dpy);
+        pending = n;
+        churn(&pending, 5000000);
+        /*
+         * a late MapNotify must not count for the next burst
+         */
+        for (i = nlive - n; i < nlive && pending; i++)
+            if (live(i)->w_mapped) {
+                live(i)->w_mapped = 0;
+                ntimeouts++;
+                pending--;
+            }
+        busy += now() - t;
+        created += n;
+    }
+    destroyoldest(nlive);
+    XSync(dpy, False);
+
+    qsort(latencies, nlatencies, sizeof(uint64_t), cmpu64);
+    printf("windows      %u created, %u mapped by the WM, %u timed out\n",
+           created, nlatencies, ntimeouts);
+    printf("configured   %u before mapping\n", nconfigured);
+    printf("renames      %llu\n", (unsigned long long) nrenames);
+    printf("wall time    %.3f s, mapping %.3f s\n",
+           (now() - start) / 1e6, busy / 1e6);
+    if (nlatencies) {
+        printf("throughput   %.1f windows/s\n", nlatencies / (busy / 1e6));
+        printf("map latency  p50 %llu us, p99 %llu us, max %llu us\n",
+               (unsigned long long) latencies[nlatencies / 2],
+               (unsigned long long) latencies[(nlatencies - 1) * 99 / 100],
+               (unsigned long long) latencies[nlatencies - 1]);
+    }
+    XCloseDisplay(dpy);
+    return ntimeouts ? EXIT_FAILURE : EXIT_SUCCESS;
+}
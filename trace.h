@@ -0,0 +1,44 @@
+/*
+ * See LICENSE file for copyright and license details. Event trace format
+ * shared by dwm -t and dwmreplay. A trace is a TraceHeader followed by
+ * TraceRecords in host byte order. Atoms which are not predefined are
+ * announced once by a TRACE_ATOMNAME record, t_extra holding the atom and
+ * t_w the length of the name which follows the record.
+ */
+#include <stdint.h>
+
+#define TRACE_MAGIC	0x746d7764      /* "dwmt" */
+#define TRACE_VERSION	1
+
+enum {
+    TRACE_ATOMNAME = 0,         /* below LASTEvent, never an event type */
+};
+
+enum {
+    TRACE_RUN,                  /* handled in run() */
+    TRACE_MOVE,                 /* handled in movemouse() */
+    TRACE_RESIZE,               /* handled in resizemouse() */
+};
+
+typedef struct {
+    uint32_t    h_magic;
+    uint32_t    h_version;
+    uint32_t    h_recsize;      /* sizeof(TraceRecord) */
+    uint32_t    h_pad;
+} TraceHeader;
+
+typedef struct {
+    uint64_t    t_usec;         /* start of handling, since trace start */
+    uint32_t    t_latency;      /* usec spent handling the event */
+    uint32_t    t_requests;     /* X requests issued while handling */
+    uint32_t    t_window;       /* xany.window */
+    uint32_t    t_subject;      /* window the event is about */
+    uint32_t    t_extra;        /* keycode, button, atom, value_mask ... */
+    uint32_t    t_keysym;       /* KeyPress only */
+    uint32_t    t_state;        /* modifier, property state, own unmap */
+    int16_t     t_x, t_y;
+    uint16_t    t_w, t_h;
+    uint8_t     t_type;         /* X event type */
+    uint8_t     t_origin;       /* TRACE_RUN, TRACE_MOVE, TRACE_RESIZE */
+    uint16_t    t_pad;
+} TraceRecord;